@@ -0,0 +1,65 @@
+#include "alias.h"
+
+#include <stdio.h>  // for fprintf, stderr, NULL
+#include <stdlib.h> // for free, malloc
+
+#include "helpers.h" // for randint, randuniform
+
+int alias_build(const double *weights, int n, alias_t *table) {
+  double total = 0;
+  for (int i = 0; i < n; ++i) {
+    total += weights[i];
+  }
+  int *small = malloc((n + 1) * sizeof(int));
+  int *large = malloc((n + 1) * sizeof(int));
+  if (small == NULL || large == NULL) {
+    fprintf(stderr, "ERROR: could not allocate alias table\n");
+    free(large);
+    free(small);
+    return 0;
+  }
+
+  // Vose's variant: pair each index with less than average weight with one
+  // with more, which donates the missing probability.
+  int num_small = 0, num_large = 0;
+  for (int i = 0; i < n; ++i) {
+    table[i].prob = (total > 0) ? weights[i] * n / total : 1;
+    table[i].alias = i;
+    table[i].reserved = 0;
+    if (table[i].prob < 1) {
+      small[num_small++] = i;
+    } else {
+      large[num_large++] = i;
+    }
+  }
+  while (num_small > 0 && num_large > 0) {
+    int s = small[--num_small];
+    int l = large[num_large - 1];
+    table[s].alias = l;
+    table[l].prob -= 1 - table[s].prob;
+    if (table[l].prob < 1) {
+      --num_large;
+      small[num_small++] = l;
+    }
+  }
+  // Only rounding errors are left.
+  while (num_small > 0) {
+    table[small[--num_small]].prob = 1;
+  }
+  while (num_large > 0) {
+    table[large[--num_large]].prob = 1;
+  }
+
+  free(large);
+  free(small);
+  return 1;
+}
+
+int alias_pick(const alias_t *table, int n, random_t *rng) {
+  int i = randint(rng, n);
+  // Corrupt tables from banks must not lead out of bounds.
+  if (randuniform(rng) < table[i].prob || table[i].alias >= (uint32_t)n) {
+    return i;
+  }
+  return table[i].alias;
+}
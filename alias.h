@@ -0,0 +1,24 @@
+#ifndef ALIAS_H
+#define ALIAS_H
+
+#include <stdint.h> // for uint32_t
+
+#include "helpers.h" // for random_t
+
+// Walker's alias method: once the table for n weights is built, picking an
+// index with probability proportional to its weight takes constant time.
+// The layout is also used in compiled banks.
+typedef struct {
+  double prob;    // Probability of keeping the index rather than the alias.
+  uint32_t alias; // Index to pick otherwise.
+  uint32_t reserved;
+} alias_t;
+
+// Builds the table for n non-negative weights. If all weights are zero, picks
+// are uniform. Returns 0 on failure.
+int alias_build(const double *weights, int n, alias_t *table);
+
+// Picks an index in [0, n).
+int alias_pick(const alias_t *table, int n, random_t *rng);
+
+#endif
@@ -0,0 +1,115 @@
+#include "arena.h"
+
+#include <stdarg.h> // for va_end, va_start, va_list
+#include <stdint.h> // for uintptr_t, SIZE_MAX
+#include <stdio.h>  // for fprintf, stderr
+#include <stdlib.h> // for free, malloc
+#include <string.h> // for memchr, memcpy, memset
+
+#include "helpers.h" // for d0_vformat
+
+// Size of the first chunk allocated; later ones double up to the max.
+#define CHUNK_MIN 4096
+#define CHUNK_MAX 65536
+
+typedef union {
+  long double ld;
+  long long ll;
+  void *p;
+  void (*fn)(void);
+} align_t;
+
+#define ALIGN sizeof(align_t)
+
+struct arena_chunk_s {
+  arena_chunk_t *next;
+  size_t size;
+  align_t data[];
+};
+
+void arena_init(arena_t *arena, void *buf, size_t size) {
+  arena->chunks = NULL;
+  arena->next = buf;
+  arena->left = (buf == NULL) ? 0 : size;
+}
+
+void *arena_alloc(arena_t *arena, size_t size) {
+  size_t pad = (ALIGN - (uintptr_t)arena->next % ALIGN) % ALIGN;
+  if (arena->left < pad || arena->left - pad < size) {
+    size_t chunk_size =
+        (arena->chunks == NULL) ? CHUNK_MIN : arena->chunks->size * 2;
+    if (chunk_size > CHUNK_MAX) {
+      chunk_size = CHUNK_MAX;
+    }
+    if (chunk_size < size) {
+      chunk_size = size;
+    }
+    if (chunk_size > SIZE_MAX - sizeof(arena_chunk_t)) {
+      fprintf(stderr, "ERROR: could not allocate %d bytes\n", (int)size);
+      return NULL;
+    }
+    arena_chunk_t *chunk = malloc(sizeof(arena_chunk_t) + chunk_size);
+    if (chunk == NULL) {
+      fprintf(stderr, "ERROR: could not allocate %d bytes\n", (int)size);
+      return NULL;
+    }
+    chunk->next = arena->chunks;
+    chunk->size = chunk_size;
+    arena->chunks = chunk;
+    arena->next = (char *)chunk->data;
+    arena->left = chunk_size;
+    pad = 0;
+  }
+  void *out = arena->next + pad;
+  arena->next += pad + size;
+  arena->left -= pad + size;
+  return out;
+}
+
+void *arena_calloc(arena_t *arena, size_t n, size_t size) {
+  if (size != 0 && n > SIZE_MAX / size) {
+    fprintf(stderr, "ERROR: could not allocate %d * %d bytes\n", (int)n,
+            (int)size);
+    return NULL;
+  }
+  void *out = arena_alloc(arena, n * size);
+  if (out != NULL) {
+    memset(out, 0, n * size);
+  }
+  return out;
+}
+
+char *arena_strndup(arena_t *arena, const char *s, size_t n) {
+  const char *nul = memchr(s, 0, n);
+  size_t len = (nul == NULL) ? n : (size_t)(nul - s);
+  char *out = arena_alloc(arena, len + 1);
+  if (out == NULL) {
+    return NULL;
+  }
+  memcpy(out, s, len);
+  out[len] = 0;
+  return out;
+}
+
+static void *format_alloc(void *ctx, size_t size) {
+  return arena_alloc(ctx, size);
+}
+
+char *arena_asprintf(arena_t *arena, const char *restrict fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  // Arena memory is only released all at once.
+  char *buf = d0_vformat(fmt, ap, format_alloc, NULL, arena);
+  va_end(ap);
+  return buf;
+}
+
+void arena_free(arena_t *arena) {
+  while (arena->chunks != NULL) {
+    arena_chunk_t *next = arena->chunks->next;
+    free(arena->chunks);
+    arena->chunks = next;
+  }
+  arena->next = NULL;
+  arena->left = 0;
+}
@@ -0,0 +1,28 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h> // for size_t
+
+typedef struct arena_chunk_s arena_chunk_t;
+
+// Allocates memory that is all released at once, e.g. at the end of an
+// authentication. Allocation just bumps a pointer most of the time.
+typedef struct {
+  char *next;
+  size_t left;
+  arena_chunk_t *chunks;
+} arena_t;
+
+// Starts an arena, optionally using the given buffer first.
+void arena_init(arena_t *arena, void *buf, size_t size);
+
+// Returns memory suitably aligned for any type, or NULL on failure.
+void *arena_alloc(arena_t *arena, size_t size);
+void *arena_calloc(arena_t *arena, size_t n, size_t size);
+char *arena_strndup(arena_t *arena, const char *s, size_t n);
+char *arena_asprintf(arena_t *arena, const char *restrict fmt, ...);
+
+// Releases everything allocated from the arena. It can be used again after.
+void arena_free(arena_t *arena);
+
+#endif
@@ -0,0 +1,99 @@
+#include "bank.h"
+
+#include <limits.h> // for INT_MAX
+#include <stdio.h>  // for fprintf, stderr
+#include <string.h> // for memcmp
+
+int bank_detect(const char *data, size_t size) {
+  return size >= BANK_HEADER_V1_SIZE &&
+         !memcmp(data, BANK_MAGIC, sizeof(BANK_MAGIC) - 1);
+}
+
+static int bank_range_ok(size_t size, uint64_t offset, uint64_t count,
+                         size_t item_size, size_t align) {
+  if (offset % align != 0 || offset > size) {
+    return 0;
+  }
+  return count <= (size - offset) / item_size;
+}
+
+int bank_load(const char *data, size_t size, bank_t *bank) {
+  if (!bank_detect(data, size)) {
+    fprintf(stderr, "ERROR: not a compiled question bank\n");
+    return 0;
+  }
+  const bank_header *header = (const bank_header *)data;
+  if (header->byte_order != BANK_BYTE_ORDER) {
+    fprintf(stderr, "ERROR: question bank compiled for another byte order\n");
+    return 0;
+  }
+  if (header->num_groups > INT_MAX || header->num_rows > INT_MAX) {
+    fprintf(stderr, "ERROR: question bank too large\n");
+    return 0;
+  }
+  if (header->version != 1 && header->version != BANK_VERSION) {
+    fprintf(stderr, "ERROR: unsupported question bank version %u\n",
+            (unsigned)header->version);
+    return 0;
+  }
+  int weighted = 0;
+  if (header->version >= 2) {
+    if (size < sizeof(bank_header)) {
+      fprintf(stderr, "ERROR: corrupt question bank\n");
+      return 0;
+    }
+    weighted = header->flags & BANK_WEIGHTED;
+  }
+  if (weighted &&
+      (!bank_range_ok(size, header->group_weights_offset, header->num_groups,
+                      sizeof(double), sizeof(uint64_t)) ||
+       !bank_range_ok(size, header->alias_offset, header->num_rows,
+                      sizeof(alias_t), sizeof(uint64_t)))) {
+    fprintf(stderr, "ERROR: corrupt question bank\n");
+    return 0;
+  }
+  if (!bank_range_ok(size, header->groups_offset, header->num_groups,
+                     sizeof(bank_group), sizeof(uint64_t)) ||
+      !bank_range_ok(size, header->rows_offset, header->num_rows,
+                     sizeof(bank_row), sizeof(uint64_t)) ||
+      !bank_range_ok(size, header->strings_offset, header->strings_size, 1,
+                     1) ||
+      header->strings_size == 0 ||
+      data[header->strings_offset + header->strings_size - 1] != 0) {
+    fprintf(stderr, "ERROR: corrupt question bank\n");
+    return 0;
+  }
+  bank->header = header;
+  bank->groups = (const bank_group *)(data + header->groups_offset);
+  bank->rows = (const bank_row *)(data + header->rows_offset);
+  bank->strings = data + header->strings_offset;
+  bank->group_weights =
+      weighted ? (const double *)(data + header->group_weights_offset) : NULL;
+  bank->alias =
+      weighted ? (const alias_t *)(data + header->alias_offset) : NULL;
+
+  uint64_t rows = 0;
+  for (uint32_t i = 0; i < header->num_groups; ++i) {
+    const bank_group *group = &bank->groups[i];
+    if (group->match >= header->strings_size || group->first_row != rows ||
+        group->num_rows > header->num_rows - rows) {
+      fprintf(stderr, "ERROR: corrupt question bank group %u\n", (unsigned)i);
+      return 0;
+    }
+    rows += group->num_rows;
+  }
+  if (rows != header->num_rows) {
+    fprintf(stderr, "ERROR: corrupt question bank groups\n");
+    return 0;
+  }
+  return 1;
+}
+
+const char *bank_string(const bank_t *bank, uint64_t offset) {
+  if (offset >= bank->header->strings_size) {
+    fprintf(stderr, "ERROR: corrupt question bank string %lu\n",
+            (unsigned long)offset);
+    return NULL;
+  }
+  return bank->strings + offset;
+}
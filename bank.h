@@ -0,0 +1,78 @@
+#ifndef BANK_H
+#define BANK_H
+
+#include <stddef.h> // for size_t, offsetof
+#include <stdint.h> // for uint32_t, uint64_t
+
+#include "alias.h" // for alias_t
+
+// Compiled question bank, as written by pam_questions_compile.
+//
+// Layout: a bank_header, followed by the groups, the rows and the string
+// table at the offsets given in the header. Rows are ordered by group, and
+// every group holds all rows sharing one match value. All strings are NUL
+// terminated offsets into the string table, which holds each string once.
+// Integers are in host byte order.
+//
+// Since version 2, banks of weighted questions (BANK_WEIGHTED) also hold the
+// weight of every group and, per row, the alias table of its group. Version 1
+// banks, whose header ends before flags, are still read.
+
+#define BANK_MAGIC "PQBANK\r\n"
+#define BANK_VERSION 2
+#define BANK_BYTE_ORDER 0x01020304
+
+#define BANK_WEIGHTED 1
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t num_groups;
+  uint32_t num_rows;
+  uint64_t groups_offset;
+  uint64_t rows_offset;
+  uint64_t strings_offset;
+  uint64_t strings_size;
+  // Version 2.
+  uint32_t flags;
+  uint32_t reserved;
+  uint64_t group_weights_offset; // A double per group.
+  uint64_t alias_offset;         // An alias_t per row, indexing its group.
+} bank_header;
+
+#define BANK_HEADER_V1_SIZE offsetof(bank_header, flags)
+
+typedef struct {
+  uint64_t match;
+  uint32_t first_row;
+  uint32_t num_rows;
+} bank_group;
+
+typedef struct {
+  uint64_t question;
+  uint64_t answer;
+} bank_row;
+
+typedef struct {
+  const bank_header *header;
+  const bank_group *groups;
+  const bank_row *rows;
+  const char *strings;
+  // NULL unless weighted.
+  const double *group_weights;
+  const alias_t *alias;
+} bank_t;
+
+// Returns whether data looks like a compiled bank.
+int bank_detect(const char *data, size_t size);
+
+// Validates the header and groups of a compiled bank and sets up bank to
+// access it. Rows are only checked when accessed, so this does not touch most
+// of the bank. Returns 0 if the bank is invalid.
+int bank_load(const char *data, size_t size, bank_t *bank);
+
+// Returns the string at offset, or NULL if the bank is corrupt.
+const char *bank_string(const bank_t *bank, uint64_t offset);
+
+#endif
@@ -0,0 +1,131 @@
+#define _POSIX_C_SOURCE 200809L
+
+// Benchmarks pam_sm_authenticate of a module in-process, using a stand-in for
+// libpam whose conversation answers correctly with a given probability, for
+// every user of every PAM config file given.
+
+#include <security/pam_appl.h>    // for PAM_AUTH_ERR, PAM_SUCCESS
+#include <security/pam_modules.h> // for pam_sm_authenticate
+#include <stdio.h>                // for fprintf, printf, snprintf, NULL, ...
+#include <stdlib.h>               // for free, malloc, qsort, atoi, strtod
+#include <string.h>               // for strcmp
+
+#include "fake_pam.h"  // for fake_pam_script_t, oracle_t, fake_pam_...
+#include "helpers.h"   // for random_init
+#include "questions.h" // for module_name
+
+#define WARMUP 100
+
+// Only the oracle of the module linked in is defined.
+extern const oracle_t math_oracle __attribute__((weak));
+extern const oracle_t questions_file_oracle __attribute__((weak));
+
+static int compare_ll(const void *a, const void *b) {
+  long long x = *(const long long *)a, y = *(const long long *)b;
+  return (x > y) - (x < y);
+}
+
+static void bench(const char *name, fake_pam_config_t *config,
+                  const char *user, const oracle_t *oracle, int iterations,
+                  double p_correct) {
+  fake_pam_script_t script = {.oracle = oracle, .p_correct = p_correct};
+  script.oracle_state = oracle->init(user, config->num_args, config->args);
+  if (script.oracle_state == NULL) {
+    fprintf(stderr, "ERROR: could not prepare answers for %s %s\n", name,
+            user);
+    return;
+  }
+  long long *latencies = malloc(iterations * sizeof(long long));
+  if (latencies == NULL) {
+    fprintf(stderr, "ERROR: could not allocate latencies\n");
+    oracle->free((void *)script.oracle_state);
+    return;
+  }
+  random_init(&script.rng);
+  long long setup = 0, module = 0, conversation = 0;
+  long ok = 0, failed = 0, errors = 0;
+  for (int i = -WARMUP; i < iterations; ++i) {
+    pam_handle_t pamh;
+    fake_pam_start(&pamh, user, &script);
+    int result = pam_sm_authenticate(&pamh, 0, config->num_args, config->args);
+    long long end = fake_pam_now_ns();
+    fake_pam_end(&pamh);
+    if (i < 0) {
+      continue;
+    }
+    long long first = (script.first_prompt == 0) ? end : script.first_prompt;
+    latencies[i] = end - script.start;
+    setup += first - script.start;
+    conversation += script.in_conversation;
+    module += end - first - script.in_conversation;
+    if (result == PAM_SUCCESS) {
+      ++ok;
+    } else if (result == PAM_AUTH_ERR) {
+      ++failed;
+    } else {
+      ++errors;
+    }
+  }
+  long long total = 0;
+  for (int i = 0; i < iterations; ++i) {
+    total += latencies[i];
+  }
+  qsort(latencies, iterations, sizeof(long long), compare_ll);
+  printf("%s %s: %.0f auth/s, p50 %.2f us, p99 %.2f us; "
+         "setup %.2f us, module %.2f us, conversation %.2f us; "
+         "%ld ok, %ld failed, %ld errors, %ld unknown questions\n",
+         name, user, iterations / (total / 1e9),
+         latencies[iterations / 2] / 1e3,
+         latencies[iterations - 1 - iterations / 100] / 1e3,
+         setup / 1e3 / iterations, module / 1e3 / iterations,
+         conversation / 1e3 / iterations, ok, failed, errors, script.unknown);
+  free(latencies);
+  oracle->free((void *)script.oracle_state);
+}
+
+int main(int argc, char **argv) {
+  int iterations = 10000;
+  double p_correct = 1;
+  int i = 1;
+  for (; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+    if (!strcmp(argv[i], "-n")) {
+      iterations = atoi(argv[i + 1]);
+    } else if (!strcmp(argv[i], "-p")) {
+      p_correct = strtod(argv[i + 1], NULL);
+    } else {
+      break;
+    }
+  }
+  if (i >= argc || iterations <= 0) {
+    fprintf(stderr,
+            "Usage: %s [-n iterations] [-p probability of correct answers] "
+            "pam_config...\n",
+            argv[0]);
+    return 1;
+  }
+  const oracle_t *oracle = &math_oracle;
+  if (oracle == NULL || strcmp(oracle->module_name, module_name) != 0) {
+    oracle = &questions_file_oracle;
+  }
+  char module[256];
+  snprintf(module, sizeof(module), "%s.so", module_name);
+  int status = 0;
+  for (; i < argc; ++i) {
+    fake_pam_config_t config;
+    int found = fake_pam_parse_config(argv[i], module, &config);
+    if (found < 0) {
+      status = 1;
+    }
+    if (found <= 0) {
+      continue;
+    }
+    char *users[FAKE_PAM_USERS_MAX];
+    int num_users = fake_pam_find_users(&config, users);
+    for (int j = 0; j < num_users; ++j) {
+      bench(argv[i], &config, users[j], oracle, iterations, p_correct);
+      free(users[j]);
+    }
+    fake_pam_free_config(&config);
+  }
+  return status;
+}
@@ -0,0 +1,115 @@
+// Answers the questions of pam_math for the benchmark by computing them.
+
+#include <stdio.h>  // for snprintf, size_t
+#include <stdlib.h> // for strtol
+#include <string.h> // for strncmp, strchr, strlen
+
+#include "fake_pam.h" // for oracle_t
+
+// The questions do not depend on the arguments, so there is no state.
+static void *init(const char *user __attribute__((unused)),
+                  int argc __attribute__((unused)),
+                  const char **argv __attribute__((unused))) {
+  static char no_state;
+  return &no_state;
+}
+
+static void free_state(void *state __attribute__((unused))) {}
+
+// Skips s over prefix if it starts with it.
+static int skip(const char **s, const char *prefix) {
+  size_t len = strlen(prefix);
+  if (strncmp(*s, prefix, len) != 0) {
+    return 0;
+  }
+  *s += len;
+  return 1;
+}
+
+// Parses a number, which may be in parentheses.
+static int parse_number(const char **s, long *n) {
+  int parens = skip(s, "(");
+  char *end;
+  *n = strtol(*s, &end, 10);
+  if (end == *s) {
+    return 0;
+  }
+  *s = end;
+  return !parens || skip(s, ")");
+}
+
+static long gcd(long a, long b) {
+  while (b != 0) {
+    long t = a % b;
+    a = b;
+    b = t;
+  }
+  return a < 0 ? -a : a;
+}
+
+static int answer(const void *state __attribute__((unused)),
+                  const char *prompt, char *buf, size_t size) {
+  const char *s = prompt;
+  if (!skip(&s, "What is ")) {
+    return 0;
+  }
+  enum { PLAIN, CANCEL, FLOOR, TRUNC } kind = PLAIN;
+  if (skip(&s, "the result of cancelling ")) {
+    kind = CANCEL;
+  } else if (skip(&s, "floor(") || skip(&s, "⌊")) {
+    kind = FLOOR;
+  } else if (skip(&s, "[")) {
+    kind = TRUNC;
+  }
+  long a, b;
+  if (!parse_number(&s, &a) || !skip(&s, " ")) {
+    return 0;
+  }
+  const char *op = s;
+  const char *op_end = strchr(op, ' ');
+  if (op_end == NULL) {
+    return 0;
+  }
+  s = op_end + 1;
+  if (!parse_number(&s, &b)) {
+    return 0;
+  }
+  size_t op_len = op_end - op;
+  long c;
+  if (kind == CANCEL) {
+    if (b == 0) {
+      return 0;
+    }
+    long d = (b < 0) ? -gcd(a, b) : gcd(a, b);
+    if (b / d == 1) {
+      return snprintf(buf, size, "%ld", a / d) < (int)size;
+    }
+    return snprintf(buf, size, "%ld/%ld", a / d, b / d) < (int)size;
+  }
+  if (op_len == 1 && *op == '+') {
+    c = a + b;
+  } else if (op_len == 1 && *op == '-') {
+    c = a - b;
+  } else if ((op_len == 1 && *op == '*') || !strncmp(op, "× ", op_len + 1)) {
+    c = a * b;
+  } else if (b == 0) {
+    return 0;
+  } else if ((op_len == 1 && *op == '/') || !strncmp(op, "÷ ", op_len + 1)) {
+    c = a / b;
+    if (kind == FLOOR && (a % b != 0) && ((a < 0) != (b < 0))) {
+      --c;
+    }
+  } else if (!strncmp(op, "mod ", op_len + 1)) {
+    c = a % b;
+    if (c != 0 && (c < 0) != (b < 0)) {
+      c += b;
+    }
+  } else if (!strncmp(op, "rem ", op_len + 1)) {
+    c = a % b;
+  } else {
+    return 0;
+  }
+  return snprintf(buf, size, "%ld", c) < (int)size;
+}
+
+const oracle_t math_oracle = {"pam_math", init, answer, free_state};
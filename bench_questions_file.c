@@ -0,0 +1,180 @@
+#define _POSIX_C_SOURCE 200809L
+
+// Answers the questions of pam_questions_file for the benchmark by looking
+// them up in the questions files of the user.
+
+#include <stdint.h> // for uint64_t
+#include <stdio.h>  // for fprintf, stderr, NULL, size_t
+#include <stdlib.h> // for free, calloc, realloc
+#include <string.h> // for strlen, strchr, strcmp, strncmp
+
+#include "bank.h"         // for bank_string, bank_t, bank_row
+#include "fake_pam.h"     // for oracle_t
+#include "helpers.h"      // for d0_strlcpy, d0_strndup, hash_bytes
+#include "options.h"      // for for_each_option
+#include "source_cache.h" // for source_t, source_acquire, source_release
+
+typedef struct {
+  const char *question;
+  const char *answer;
+} entry_t;
+
+typedef struct {
+  source_t **sources;
+  int num_sources;
+  entry_t *table;
+  size_t table_size;
+} state_t;
+
+static void find_files(void *ctx, const char *field,
+                       const char *arg __attribute__((unused))) {
+  if (!strncmp(field, "file=", 5)) {
+    *(const char **)ctx = field + 5;
+  }
+}
+
+static int add_source(state_t *state, source_t *source) {
+  source_t **new_sources =
+      realloc(state->sources, (state->num_sources + 1) * sizeof(source_t *));
+  if (new_sources == NULL) {
+    source_release(source);
+    return 0;
+  }
+  state->sources = new_sources;
+  state->sources[state->num_sources++] = source;
+  return 1;
+}
+
+static int acquire(state_t *state, const char *name) {
+  source_t *source = source_acquire(name, 1);
+  if (source == NULL) {
+    return 1;
+  }
+  if (!source->is_dir) {
+    return add_source(state, source);
+  }
+  for (int i = 0; i < source->num_names; ++i) {
+    source_t *file = source_acquire(source->names[i], 1);
+    if (file != NULL && !add_source(state, file)) {
+      source_release(source);
+      return 0;
+    }
+  }
+  source_release(source);
+  return 1;
+}
+
+static entry_t *lookup(const state_t *state, const char *question,
+                       size_t len) {
+  size_t mask = state->table_size - 1;
+  size_t i = hash_bytes(question, len) & mask;
+  while (state->table[i].question != NULL &&
+         (strlen(state->table[i].question) != len ||
+          strncmp(state->table[i].question, question, len) != 0)) {
+    i = (i + 1) & mask;
+  }
+  return &state->table[i];
+}
+
+static void insert(state_t *state, const char *question, const char *answer) {
+  if (question == NULL || answer == NULL) {
+    return;
+  }
+  entry_t *entry = lookup(state, question, strlen(question));
+  if (entry->question == NULL) {
+    entry->question = question;
+    entry->answer = answer;
+  }
+}
+
+static size_t source_rows(const source_t *source) {
+  return source->is_bank ? source->bank.header->num_rows
+                         : (size_t)source->num_rows;
+}
+
+static void free_state(void *ptr) {
+  state_t *state = ptr;
+  free(state->table);
+  for (int i = 0; i < state->num_sources; ++i) {
+    source_release(state->sources[i]);
+  }
+  free(state->sources);
+  free(state);
+}
+
+static int fill_table(state_t *state) {
+  size_t rows = 0;
+  for (int i = 0; i < state->num_sources; ++i) {
+    rows += source_rows(state->sources[i]);
+  }
+  for (state->table_size = 16; state->table_size < 2 * rows;) {
+    state->table_size *= 2;
+  }
+  state->table = calloc(state->table_size, sizeof(entry_t));
+  if (state->table == NULL) {
+    fprintf(stderr, "ERROR: could not allocate answer table\n");
+    return 0;
+  }
+  for (int i = 0; i < state->num_sources; ++i) {
+    const source_t *source = state->sources[i];
+    for (size_t r = 0; r < source_rows(source); ++r) {
+      if (source->is_bank) {
+        const bank_row *row = &source->bank.rows[r];
+        insert(state, bank_string(&source->bank, row->question),
+               bank_string(&source->bank, row->answer));
+      } else {
+        insert(state, source->rows[r].question, source->rows[r].answer);
+      }
+    }
+  }
+  return 1;
+}
+
+static void *init(const char *user, int argc, const char **argv) {
+  state_t *state = calloc(1, sizeof(state_t));
+  if (state == NULL) {
+    fprintf(stderr, "ERROR: could not allocate oracle state\n");
+    return NULL;
+  }
+  const char *files = "/usr/lib/pam_math/questions.csv";
+  for_each_option(user, argc, argv, find_files, &files);
+  for (const char *p = files; *p;) {
+    const char *sep = strchr(p, ':');
+    size_t len = (sep == NULL) ? strlen(p) : (size_t)(sep - p);
+    char *path = d0_strndup(p, len);
+    if (path == NULL) {
+      free_state(state);
+      return NULL;
+    }
+    p += len + (sep != NULL);
+    int ok = (*path == 0) || acquire(state, path);
+    free(path);
+    if (!ok) {
+      free_state(state);
+      return NULL;
+    }
+  }
+  if (!fill_table(state)) {
+    free_state(state);
+    return NULL;
+  }
+  return state;
+}
+
+// Questions are prompted followed by a space.
+static int answer(const void *state, const char *prompt, char *buf,
+                  size_t size) {
+  size_t len = strlen(prompt);
+  if (len == 0 || prompt[len - 1] != ' ') {
+    return 0;
+  }
+  const entry_t *entry = lookup(state, prompt, len - 1);
+  if (entry->question == NULL) {
+    return 0;
+  }
+  d0_strlcpy(buf, entry->answer, size);
+  return 1;
+}
+
+const oracle_t questions_file_oracle = {"pam_questions_file", init, answer,
+                                        free_state};
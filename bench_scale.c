@@ -0,0 +1,111 @@
+#define _POSIX_C_SOURCE 200809L
+
+// Times build_config and make_question of pam_questions_file on a questions
+// file for several match= patterns, to see how they scale with its size.
+
+#include <stdio.h>        // for printf, fprintf, snprintf, stderr, NULL
+#include <stdlib.h>       // for atoi
+#include <string.h>       // for strcmp
+#include <sys/resource.h> // for getrusage, rusage, RUSAGE_SELF
+#include <time.h>         // for clock_gettime, timespec
+
+#include "arena.h"     // for arena_free, arena_init, arena_t
+#include "helpers.h"   // for random_init, random_t
+#include "questions.h" // for build_config, free_config, make_question
+
+#define PATTERNS_MAX 32
+#define OPTION_MAX 4096
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static long peak_rss_kb(void) {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+static int bench(const char *file, const char *pattern, int iterations) {
+  char file_arg[OPTION_MAX], match_arg[OPTION_MAX];
+  snprintf(file_arg, sizeof(file_arg), ".file=%s", file);
+  snprintf(match_arg, sizeof(match_arg), ".match=%s", pattern);
+  const char *argv[] = {file_arg, match_arg, ".threads=1"};
+  int argc = sizeof(argv) / sizeof(*argv);
+
+  random_t rng;
+  random_init(&rng);
+  double build = 0, first = 0, questions = 0;
+  int made = 0;
+  for (int i = 0; i <= iterations; ++i) {
+    double start = now();
+    config_t *config = build_config("user", argc, argv);
+    if (config == NULL) {
+      return 0;
+    }
+    double built = now();
+    arena_t arena;
+    char buf[2048];
+    arena_init(&arena, buf, sizeof(buf));
+    answer_state_t *answer_state;
+    int ok = make_question(config, &rng, &arena, &answer_state) != NULL;
+    double end = now();
+    arena_free(&arena);
+    free_config(config);
+    if (i == 0) {
+      // Includes loading the file into the cache.
+      first = end - start;
+      continue;
+    }
+    build += built - start;
+    questions += end - built;
+    made += ok;
+  }
+  printf("%s match=%s: first %.3f ms, build_config %.2f us, "
+         "make_question %.2f us, %d/%d made, peak RSS %ld KiB\n",
+         file, pattern, first * 1e3, build / iterations * 1e6,
+         questions / iterations * 1e6, made, iterations, peak_rss_kb());
+  return 1;
+}
+
+int main(int argc, char **argv) {
+  int iterations = 100;
+  const char *patterns[PATTERNS_MAX];
+  int num_patterns = 0;
+  int i = 1;
+  for (; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+    if (!strcmp(argv[i], "-n")) {
+      iterations = atoi(argv[i + 1]);
+    } else if (!strcmp(argv[i], "-m") && num_patterns < PATTERNS_MAX) {
+      patterns[num_patterns++] = argv[i + 1];
+    } else {
+      break;
+    }
+  }
+  if (i >= argc || iterations <= 0) {
+    fprintf(stderr,
+            "Usage: %s [-n iterations] [-m match pattern]... "
+            "questions.csv...\n",
+            argv[0]);
+    return 1;
+  }
+  if (num_patterns == 0) {
+    // All rows, one group, a tenth of the groups through the DFA, and the
+    // same through regexec.
+    patterns[num_patterns++] = ".*";
+    patterns[num_patterns++] = "m1";
+    patterns[num_patterns++] = "m[0-9]*7";
+    patterns[num_patterns++] = "^m[0-9]*7$";
+  }
+  int status = 0;
+  for (; i < argc; ++i) {
+    for (int j = 0; j < num_patterns; ++j) {
+      if (!bench(argv[i], patterns[j], iterations)) {
+        status = 1;
+      }
+    }
+  }
+  return status;
+}
@@ -0,0 +1,162 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "config_cache.h"
+
+#include <langinfo.h> // for nl_langinfo, CODESET
+#include <pthread.h>  // for pthread_mutex_lock, pthread_mutex_unlock, ...
+#include <stdint.h>   // for uint64_t
+#include <stdio.h>    // for fprintf, stderr, NULL
+#include <stdlib.h>   // for free, malloc
+#include <string.h>   // for memcmp, memcpy, strlen
+
+#include "helpers.h" // for hash_bytes
+#include "options.h" // for options_version
+
+#define CONFIG_BUCKETS 256
+// Beyond this many configs, unused ones are dropped.
+#define CONFIG_CACHE_MAX 1024
+
+struct config_entry_s {
+  struct config_entry_s *next;
+  uint64_t hash;
+  char *key;
+  size_t key_size;
+  unsigned long version;
+  config_t *config;
+  int refs;
+};
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static config_entry_t *buckets[CONFIG_BUCKETS];
+static int cache_size;
+
+// Serializes everything a config depends on. The locale is part of it, as
+// the backends look at it.
+static char *make_key(const char *user, int argc, const char **argv,
+                      size_t *size) {
+  const char *codeset = nl_langinfo(CODESET);
+  *size = strlen(codeset) + 1 + strlen(user) + 1;
+  for (int i = 0; i < argc; ++i) {
+    *size += strlen(argv[i]) + 1;
+  }
+  char *key = malloc(*size);
+  if (key == NULL) {
+    fprintf(stderr, "ERROR: could not allocate config key\n");
+    return NULL;
+  }
+  char *p = key;
+  size_t len = strlen(codeset) + 1;
+  memcpy(p, codeset, len);
+  p += len;
+  len = strlen(user) + 1;
+  memcpy(p, user, len);
+  p += len;
+  for (int i = 0; i < argc; ++i) {
+    len = strlen(argv[i]) + 1;
+    memcpy(p, argv[i], len);
+    p += len;
+  }
+  return key;
+}
+
+static void free_entry(config_entry_t *entry) {
+  free_config(entry->config);
+  free(entry->key);
+  free(entry);
+}
+
+// Drops all configs not in use right now.
+static void evict_locked(void) {
+  for (int i = 0; i < CONFIG_BUCKETS; ++i) {
+    config_entry_t **link = &buckets[i];
+    while (*link != NULL) {
+      config_entry_t *entry = *link;
+      if (entry->refs > 1) {
+        link = &entry->next;
+        continue;
+      }
+      *link = entry->next;
+      --cache_size;
+      if (--entry->refs == 0) {
+        free_entry(entry);
+      }
+    }
+  }
+}
+
+config_t *config_acquire(const char *user, int argc, const char **argv,
+                         config_entry_t **entry) {
+  size_t key_size;
+  char *key = make_key(user, argc, argv, &key_size);
+  if (key == NULL) {
+    return NULL;
+  }
+  uint64_t hash = hash_bytes(key, key_size);
+  config_entry_t **bucket = &buckets[hash % CONFIG_BUCKETS];
+  unsigned long version = options_version(argc, argv);
+
+  pthread_mutex_lock(&cache_lock);
+  for (config_entry_t **link = bucket; *link != NULL; link = &(*link)->next) {
+    config_entry_t *e = *link;
+    if (e->hash != hash || e->key_size != key_size ||
+        memcmp(e->key, key, key_size)) {
+      continue;
+    }
+    if (e->version != version) {
+      // A config_db file changed since.
+      *link = e->next;
+      --cache_size;
+      if (--e->refs == 0) {
+        free_entry(e);
+      }
+      break;
+    }
+    ++e->refs;
+    pthread_mutex_unlock(&cache_lock);
+    free(key);
+    *entry = e;
+    return e->config;
+  }
+  pthread_mutex_unlock(&cache_lock);
+
+  // Build without holding the lock. Should another thread build the same
+  // config meanwhile, both end up cached, which is harmless.
+  config_entry_t *e = malloc(sizeof(*e));
+  if (e == NULL) {
+    fprintf(stderr, "ERROR: could not allocate config entry\n");
+    free(key);
+    return NULL;
+  }
+  e->config = build_config(user, argc, argv);
+  if (e->config == NULL) {
+    free(e);
+    free(key);
+    return NULL;
+  }
+  e->hash = hash;
+  e->key = key;
+  e->key_size = key_size;
+  e->version = version;
+  // One reference for the cache, and one for the caller.
+  e->refs = 2;
+
+  pthread_mutex_lock(&cache_lock);
+  if (cache_size >= CONFIG_CACHE_MAX) {
+    evict_locked();
+  }
+  e->next = *bucket;
+  *bucket = e;
+  ++cache_size;
+  pthread_mutex_unlock(&cache_lock);
+  *entry = e;
+  return e->config;
+}
+
+void config_release(config_entry_t *entry) {
+  pthread_mutex_lock(&cache_lock);
+  int refs = --entry->refs;
+  pthread_mutex_unlock(&cache_lock);
+  if (refs == 0) {
+    free_entry(entry);
+  }
+}
@@ -0,0 +1,17 @@
+#ifndef CONFIG_CACHE_H
+#define CONFIG_CACHE_H
+
+#include "questions.h" // for config_t
+
+typedef struct config_entry_s config_entry_t;
+
+// Returns the config for the user and module arguments, only building it if
+// the same ones were not seen before in this process. The config is shared
+// between threads and must not be modified. Returns NULL on failure;
+// otherwise *entry must be passed to config_release when done.
+config_t *config_acquire(const char *user, int argc, const char **argv,
+                         config_entry_t **entry);
+
+void config_release(config_entry_t *entry);
+
+#endif
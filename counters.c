@@ -0,0 +1,136 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "counters.h"
+
+#include <fcntl.h>    // for open, O_CLOEXEC, O_CREAT, O_NOFOLLOW, O_RDWR
+#include <pthread.h>  // for pthread_mutex_lock, pthread_mutex_unlock, ...
+#include <stdio.h>    // for fprintf, stderr, NULL
+#include <string.h>   // for strcmp, strlen
+#include <sys/mman.h> // for mmap, munmap, MAP_FAILED, MAP_SHARED, PROT_...
+#include <sys/stat.h> // for fstat, stat, S_ISREG, S_IWOTH
+#include <unistd.h>   // for close, ftruncate, geteuid
+
+#include "helpers.h" // for d0_strndup, hash_bytes
+
+// Distinct counters files a process can use.
+#define COUNTERS_FILES_MAX 16
+
+typedef struct {
+  char *name;
+  counters_t *counters; // NULL if the file could not be used.
+} mapping_t;
+
+// Mappings are only ever appended, and published by incrementing
+// num_mappings, so that they can be looked up without locking.
+static pthread_mutex_t mappings_lock = PTHREAD_MUTEX_INITIALIZER;
+static mapping_t mappings[COUNTERS_FILES_MAX];
+static int num_mappings;
+
+uint64_t counters_magic(const char *module) {
+  // Changes with the layout too.
+  return hash_bytes(module, strlen(module)) ^ sizeof(counters_t);
+}
+
+static counters_t *map_file(const char *name, const char *module) {
+  // As this usually runs as root, do not follow a symlink someone put there
+  // to have another file extended and overwritten.
+  int fd = open(name, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    fprintf(stderr, "ERROR: could not open counters file %s\n", name);
+    return NULL;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    fprintf(stderr, "ERROR: could not stat counters file %s\n", name);
+    close(fd);
+    return NULL;
+  }
+  // Only use a file of our own that nobody else can have tampered with.
+  if (!S_ISREG(st.st_mode) || st.st_uid != geteuid() ||
+      (st.st_mode & S_IWOTH) != 0) {
+    fprintf(stderr,
+            "ERROR: counters file %s must be a regular file owned by the "
+            "module's user and not writable by others\n",
+            name);
+    close(fd);
+    return NULL;
+  }
+  if ((size_t)st.st_size < sizeof(counters_t) &&
+      ftruncate(fd, sizeof(counters_t)) != 0) {
+    fprintf(stderr, "ERROR: could not size counters file %s\n", name);
+    close(fd);
+    return NULL;
+  }
+  void *data = mmap(NULL, sizeof(counters_t), PROT_READ | PROT_WRITE,
+                    MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    fprintf(stderr, "ERROR: could not map counters file %s\n", name);
+    return NULL;
+  }
+  counters_t *counters = data;
+  uint64_t magic = counters_magic(module);
+  uint64_t found = 0;
+  if (!__atomic_compare_exchange_n(&counters->magic, &found, magic, 0,
+                                   __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) &&
+      found != magic) {
+    fprintf(stderr, "ERROR: counters file %s is not one of %s\n", name,
+            module);
+    munmap(data, sizeof(counters_t));
+    return NULL;
+  }
+  return counters;
+}
+
+static mapping_t *find_mapping(const char *name, int num) {
+  for (int i = 0; i < num; ++i) {
+    if (!strcmp(mappings[i].name, name)) {
+      return &mappings[i];
+    }
+  }
+  return NULL;
+}
+
+counters_t *counters_open(const char *name, const char *module) {
+  mapping_t *mapping =
+      find_mapping(name, __atomic_load_n(&num_mappings, __ATOMIC_ACQUIRE));
+  if (mapping != NULL) {
+    return mapping->counters;
+  }
+  pthread_mutex_lock(&mappings_lock);
+  mapping = find_mapping(name, num_mappings);
+  if (mapping != NULL) {
+    pthread_mutex_unlock(&mappings_lock);
+    return mapping->counters;
+  }
+  if (num_mappings == COUNTERS_FILES_MAX) {
+    pthread_mutex_unlock(&mappings_lock);
+    fprintf(stderr, "ERROR: too many counters files\n");
+    return NULL;
+  }
+  // Files that cannot be used are remembered too, so as to not retry them on
+  // every authentication.
+  mapping = &mappings[num_mappings];
+  mapping->name = d0_strndup(name, strlen(name));
+  if (mapping->name == NULL) {
+    pthread_mutex_unlock(&mappings_lock);
+    return NULL;
+  }
+  mapping->counters = map_file(name, module);
+  __atomic_store_n(&num_mappings, num_mappings + 1, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&mappings_lock);
+  return mapping->counters;
+}
+
+void counters_add_stats(counters_t *counters, const stats_t *stats) {
+  for (int phase = 0; phase < STATS_PHASES; ++phase) {
+    if (stats->total_ns[phase] != 0) {
+      COUNTERS_ADD(counters, total_ns[phase], stats->total_ns[phase]);
+    }
+    for (int i = 0; i < STATS_BUCKETS; ++i) {
+      if (stats->buckets[phase][i] != 0) {
+        COUNTERS_ADD(counters, buckets[phase][i], stats->buckets[phase][i]);
+      }
+    }
+  }
+}
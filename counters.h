@@ -0,0 +1,49 @@
+#ifndef COUNTERS_H
+#define COUNTERS_H
+
+#include <stdint.h> // for uint64_t
+
+#include "stats.h" // for STATS_BUCKETS, STATS_PHASES, stats_t
+
+// Kinds of questions counted separately, e.g. the ops of pam_math.
+#define COUNTERS_KINDS 16
+
+// Counters kept in a file mapped by every process using it, e.g. the forked
+// sshd processes, and only updated with atomic increments. All counters only
+// ever grow.
+typedef struct {
+  // Identifies the module writing the file; see counters_magic.
+  uint64_t magic;
+  uint64_t sessions;      // Conversations started.
+  uint64_t questions;     // Questions made.
+  uint64_t exhausted;     // Questions whose attempts ran out.
+  uint64_t conv_again;    // Conversations suspended by PAM_CONV_AGAIN.
+  uint64_t config_errors; // Failures to get the config.
+  uint64_t correct[COUNTERS_KINDS];
+  uint64_t incorrect[COUNTERS_KINDS];
+  // Times of the phases of all conversations, like in stats_t.
+  uint64_t total_ns[STATS_PHASES];
+  uint64_t buckets[STATS_PHASES][STATS_BUCKETS];
+} counters_t;
+
+// The magic number of the counters of a module.
+uint64_t counters_magic(const char *module);
+
+// Maps the counters file of the given name, creating it if needed. The
+// mapping is kept for the lifetime of the process, so finding it again later
+// takes no lock and no I/O. Returns NULL on failure, or if the file belongs to
+// another module.
+counters_t *counters_open(const char *name, const char *module);
+
+// Atomically adds to a counter. Does nothing if counters is NULL.
+#define COUNTERS_ADD(counters, field, n)                                       \
+  do {                                                                         \
+    if ((counters) != NULL) {                                                  \
+      __atomic_fetch_add(&(counters)->field, (n), __ATOMIC_RELAXED);           \
+    }                                                                          \
+  } while (0)
+
+// Adds the times of a conversation.
+void counters_add_stats(counters_t *counters, const stats_t *stats);
+
+#endif
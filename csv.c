@@ -1,75 +1,246 @@
+#define _POSIX_C_SOURCE 200112L
+
 #include "csv.h"
 
-#include <stdio.h>  // for NULL
-#include <stdlib.h> // for malloc
-#include <string.h> // for strchr, strcpy, strlen, memcpy
+#include <fcntl.h>    // for open, O_RDONLY
+#include <float.h>    // for DBL_MAX
+#include <stdint.h>   // for uint32_t
+#include <stdio.h>    // for NULL, fprintf, perror, stderr
+#include <stdlib.h>   // for free, realloc, strtod
+#include <string.h>   // for memcpy, memmove
+#include <sys/mman.h> // for mmap, munmap, posix_madvise, MAP_FAILED, ...
+#include <sys/stat.h> // for fstat, stat, S_ISREG
+#include <unistd.h>   // for close, read, ssize_t
+
+#include "csv_scan.h" // for csv_classify, csv_mask_select, csv_scan, ...
+#include "helpers.h"  // for d0_strndup
 
-#include "helpers.h" // for d0_strndup
+#define READ_CHUNK 65536
 
-void csv_start(char *s, char **buf) {
-  *buf = s;
+static int csv_read_all(int fd, csv_file *file) {
+  char *data = NULL;
+  size_t size = 0;
+  size_t capacity = 0;
   for (;;) {
-    switch (*s) {
-    case 0:
-    case '\r':
-    case '\n':
-      *s = 0;
-      return;
+    if (capacity - size < READ_CHUNK) {
+      capacity = capacity ? capacity * 2 : READ_CHUNK;
+      char *new_data = realloc(data, capacity);
+      if (new_data == NULL) {
+        fprintf(stderr, "ERROR: could not allocate %d bytes\n", (int)capacity);
+        free(data);
+        return 0;
+      }
+      data = new_data;
+    }
+    ssize_t n = read(fd, data + size, capacity - size);
+    if (n < 0) {
+      perror("ERROR: could not read questions file");
+      free(data);
+      return 0;
+    }
+    if (n == 0) {
+      break;
+    }
+    size += n;
+  }
+  file->data = data;
+  file->size = size;
+  file->mapped = 0;
+  return 1;
+}
+
+int csv_open(const char *filename, csv_file *file) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    perror("ERROR: could not open questions file");
+    return 0;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    // Writable but private, so only pages csv_read_span unescapes get copied.
+    void *data =
+        mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED) {
+      posix_madvise(data, st.st_size, POSIX_MADV_SEQUENTIAL);
+      close(fd);
+      file->data = data;
+      file->size = st.st_size;
+      file->mapped = 1;
+      return 1;
     }
+  }
+  // Not mappable (e.g. empty or a pipe) - read it instead.
+  int ok = csv_read_all(fd, file);
+  close(fd);
+  return ok;
+}
+
+int csv_read_file(const char *filename, csv_file *file) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    perror("ERROR: could not open questions file");
+    return 0;
+  }
+  int ok = csv_read_all(fd, file);
+  close(fd);
+  return ok;
+}
+
+void csv_close(csv_file *file) {
+  if (file->mapped) {
+    munmap(file->data, file->size);
+  } else {
+    free(file->data);
+  }
+  file->data = NULL;
+  file->size = 0;
+}
+
+char *csv_start(char *s, char *end, csv_buf *buf) {
+  buf->pos = s;
+  buf->block = NULL;
+  s = csv_scan(s, end, CSV_EOL);
+  buf->end = s;
+  if (s != end && *s++ == '\r' && s != end && *s == '\n') {
     ++s;
   }
+  return s;
+}
+
+// Returns the first character at or after buf->pos of one of the classes in
+// want, or buf->end if there is none. Fields sharing a block take their
+// positions from its mask; long fields are skipped with csv_scan, and the
+// block is classified from where it stops.
+static char *csv_find(csv_buf *buf, unsigned want) {
+  char *block = buf->block;
+  if (block != NULL && buf->pos - block < CSV_BLOCK) {
+    uint32_t m = csv_mask_select(&buf->mask, want) &
+                 ((uint32_t)-1 << (buf->pos - block));
+    if (m != 0) {
+      // Bits past buf->end are never set.
+      return block + __builtin_ctz(m);
+    }
+    if (block + CSV_BLOCK >= buf->end) {
+      return buf->end;
+    }
+    block += CSV_BLOCK;
+  } else {
+    block = buf->pos;
+  }
+  char *found = csv_scan(block, buf->end, want);
+  if (found != buf->end) {
+    buf->block = found;
+    csv_classify(found, buf->end, &buf->mask);
+  }
+  return found;
 }
 
-char *csv_read(char **buf) {
-  if (*buf == NULL) {
+char *csv_read(csv_buf *buf) {
+  csv_span span;
+  if (!csv_read_span(buf, &span)) {
     return NULL;
   }
-  switch (**buf) {
-  case '"': {
-    char *ret = malloc(strlen(*buf) + 1);
-    char *retpos = ret;
-    for (;;) {
-      ++*buf;
-      char *endptr = strchr(*buf, '"');
-      if (endptr == NULL) {
-        // Technically invalid CSV.
-        strcpy(retpos, *buf);
-        *buf = NULL;
-        return ret;
-      }
-      memcpy(retpos, *buf, endptr - *buf);
-      retpos += endptr - *buf;
-      *retpos = 0;
-      *buf = endptr + 1;
-      switch (**buf) {
-      case 0:
-        *buf = NULL;
-        return ret;
-      case '"':
-        *retpos++ = '"';
-        continue;
-      case ',':
-        ++*buf;
-        return ret;
-      default:
-        // Technically invalid CSV.
-        strcpy(retpos, *buf);
-        *buf = NULL;
-        return ret;
-      }
-    }
-  } break;
-  default: {
-    char *endptr = strchr(*buf, ',');
-    if (endptr == NULL) {
-      char *ret = d0_strndup(*buf, strlen(*buf));
-      *buf = NULL;
-      return ret;
+  return d0_strndup(span.ptr, span.len);
+}
+
+int csv_read_span(csv_buf *buf, csv_span *span) {
+  if (buf->pos == NULL) {
+    return 0;
+  }
+  if (buf->pos == buf->end || *buf->pos != '"') {
+    char *endptr = csv_find(buf, CSV_COMMA);
+    span->ptr = buf->pos;
+    if (endptr == buf->end) {
+      span->len = buf->end - buf->pos;
+      buf->pos = NULL;
     } else {
-      char *ret = d0_strndup(*buf, endptr - *buf);
-      *buf = endptr + 1;
-      return ret;
+      span->len = endptr - buf->pos;
+      buf->pos = endptr + 1;
+    }
+    return 1;
+  }
+  // Unescape in place; the output never overtakes the input.
+  char *out = buf->pos + 1;
+  span->ptr = out;
+  for (;;) {
+    ++buf->pos;
+    // No closing quote is technically invalid CSV.
+    char *endptr = csv_find(buf, CSV_QUOTE);
+    if (out != buf->pos) {
+      memmove(out, buf->pos, endptr - buf->pos);
+    }
+    out += endptr - buf->pos;
+    if (endptr == buf->end) {
+      break;
+    }
+    buf->pos = endptr + 1;
+    if (buf->pos == buf->end) {
+      break;
     }
+    switch (*buf->pos) {
+    case '"':
+      *out++ = '"';
+      continue;
+    case ',':
+      ++buf->pos;
+      span->len = out - span->ptr;
+      return 1;
+    default:
+      // Technically invalid CSV.
+      memmove(out, buf->pos, buf->end - buf->pos);
+      out += buf->end - buf->pos;
+      break;
+    }
+    break;
+  }
+  span->len = out - span->ptr;
+  buf->pos = NULL;
+  return 1;
+}
+
+int csv_skip(csv_buf *buf) {
+  if (buf->pos == NULL) {
+    return 0;
+  }
+  if (buf->pos == buf->end || *buf->pos != '"') {
+    char *endptr = csv_find(buf, CSV_COMMA);
+    buf->pos = (endptr == buf->end) ? NULL : endptr + 1;
+    return 1;
+  }
+  for (;;) {
+    ++buf->pos;
+    char *endptr = csv_find(buf, CSV_QUOTE);
+    if (endptr == buf->end || endptr + 1 == buf->end) {
+      break;
+    }
+    buf->pos = endptr + 1;
+    switch (*buf->pos) {
+    case '"':
+      continue;
+    case ',':
+      ++buf->pos;
+      return 1;
+    }
+    // Technically invalid CSV.
+    break;
+  }
+  buf->pos = NULL;
+  return 1;
+}
+
+int csv_span_weight(csv_span span, double *weight) {
+  if (span.len == 0) {
+    *weight = 1;
+    return 1;
   }
+  char buf[64];
+  if (span.len >= sizeof(buf)) {
+    return 0;
   }
+  memcpy(buf, span.ptr, span.len);
+  buf[span.len] = 0;
+  char *end;
+  *weight = strtod(buf, &end);
+  // Also rejects NaN and infinity.
+  return end == buf + span.len && *weight >= 0 && *weight <= DBL_MAX;
 }
@@ -1,13 +1,58 @@
 #ifndef CSV_H
 #define CSV_H
 
-typedef char *csv_buf;
+#include <stddef.h> // for size_t
 
-// Prepares buf for reading CSV. May modify the string behind s.
-void csv_start(char *s, csv_buf *buf);
+#include "csv_scan.h" // for csv_mask
+
+typedef struct {
+  char *pos;
+  char *end;
+  // The block of the line classified last, NULL if none, and its mask, so
+  // that each block is classified once however many fields it holds.
+  char *block;
+  csv_mask mask;
+} csv_buf;
+
+// A view into a line of CSV.
+typedef struct {
+  const char *ptr;
+  size_t len;
+} csv_span;
+
+// A CSV file in memory, mapped where possible. The memory is private to the
+// process, so csv_read_span may modify it.
+typedef struct {
+  char *data;
+  size_t size;
+  int mapped;
+} csv_file;
+
+// Maps a CSV file into memory. Returns 0 on failure.
+int csv_open(const char *filename, csv_file *file);
+void csv_close(csv_file *file);
+// Reads a file into memory of its own without mapping it, so that rewriting
+// the file in place cannot crash code reading it. Returns 0 on failure.
+int csv_read_file(const char *filename, csv_file *file);
+
+// Prepares buf for reading the line of CSV starting at s, where end is the end
+// of the data. Returns the start of the next line.
+char *csv_start(char *s, char *end, csv_buf *buf);
 
 // Reads the next field from a line of CSV.
 // At the end of the line, csv_read will return NULL.
 char *csv_read(csv_buf *buf);
 
+// Reads the next field from a line of CSV without copying it. Quoted fields are
+// unescaped in place. At the end of the line, csv_read_span will return 0.
+int csv_read_span(csv_buf *buf, csv_span *span);
+
+// Skips the next field from a line of CSV.
+// At the end of the line, csv_skip will return 0.
+int csv_skip(csv_buf *buf);
+
+// Parses the value of a weight column: a non-negative number, or 1 if empty.
+// Returns 0 if invalid.
+int csv_span_weight(csv_span span, double *weight);
+
 #endif
@@ -0,0 +1,180 @@
+#include "csv_scan.h"
+
+#include <stdint.h> // for uint32_t
+#include <string.h> // for memcpy, memset, strcmp, NULL
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) &&       \
+    defined(__SSE2__) && !defined(CSV_SCAN_SCALAR)
+#define CSV_SCAN_X86
+#include <immintrin.h> // for __m128i, __m256i, _mm_cmpeq_epi8, _mm256_cm...
+#endif
+
+static unsigned csv_class(char c) {
+  switch (c) {
+  case ',':
+    return CSV_COMMA;
+  case '"':
+    return CSV_QUOTE;
+  case '\r':
+  case '\n':
+    return CSV_EOL;
+  default:
+    return 0;
+  }
+}
+
+static char *scan_scalar(char *s, char *end, unsigned want) {
+  while (s != end && (csv_class(*s) & want) == 0) {
+    ++s;
+  }
+  return s;
+}
+
+static void classify_scalar(const char *s, csv_mask *mask) {
+  mask->comma = mask->quote = mask->eol = 0;
+  for (int i = 0; i < CSV_BLOCK; ++i) {
+    switch (csv_class(s[i])) {
+    case CSV_COMMA:
+      mask->comma |= (uint32_t)1 << i;
+      break;
+    case CSV_QUOTE:
+      mask->quote |= (uint32_t)1 << i;
+      break;
+    case CSV_EOL:
+      mask->eol |= (uint32_t)1 << i;
+      break;
+    }
+  }
+}
+
+#ifdef CSV_SCAN_X86
+
+static void classify_sse2(const char *s, csv_mask *mask) {
+  const __m128i comma = _mm_set1_epi8(',');
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i cr = _mm_set1_epi8('\r');
+  const __m128i lf = _mm_set1_epi8('\n');
+  mask->comma = mask->quote = mask->eol = 0;
+  for (int i = 0; i < CSV_BLOCK; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+    mask->comma |= (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, comma)) << i;
+    mask->quote |= (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, quote)) << i;
+    mask->eol |= (uint32_t)_mm_movemask_epi8(_mm_or_si128(
+                     _mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf)))
+                 << i;
+  }
+}
+
+__attribute__((target("avx2"))) static void classify_avx2(const char *s,
+                                                            csv_mask *mask) {
+  __m256i v = _mm256_loadu_si256((const __m256i *)s);
+  mask->comma = (uint32_t)_mm256_movemask_epi8(
+      _mm256_cmpeq_epi8(v, _mm256_set1_epi8(',')));
+  mask->quote = (uint32_t)_mm256_movemask_epi8(
+      _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')));
+  mask->eol = (uint32_t)_mm256_movemask_epi8(
+      _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')),
+                      _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'))));
+}
+
+static char *scan_sse2(char *s, char *end, unsigned want) {
+  csv_mask mask;
+  while (end - s >= CSV_BLOCK) {
+    classify_sse2(s, &mask);
+    uint32_t m = csv_mask_select(&mask, want);
+    if (m != 0) {
+      return s + __builtin_ctz(m);
+    }
+    s += CSV_BLOCK;
+  }
+  return scan_scalar(s, end, want);
+}
+
+__attribute__((target("avx2"))) static char *scan_avx2(char *s, char *end,
+                                                         unsigned want) {
+  csv_mask mask;
+  while (end - s >= CSV_BLOCK) {
+    classify_avx2(s, &mask);
+    uint32_t m = csv_mask_select(&mask, want);
+    if (m != 0) {
+      return s + __builtin_ctz(m);
+    }
+    s += CSV_BLOCK;
+  }
+  return scan_scalar(s, end, want);
+}
+
+#endif
+
+csv_scanner *csv_scanner_named(const char *name) {
+  if (!strcmp(name, "scalar")) {
+    return scan_scalar;
+  }
+#ifdef CSV_SCAN_X86
+  if (!strcmp(name, "sse2")) {
+    return scan_sse2;
+  }
+  if (!strcmp(name, "avx2") && __builtin_cpu_supports("avx2")) {
+    return scan_avx2;
+  }
+#endif
+  return NULL;
+}
+
+csv_classifier *csv_classifier_named(const char *name) {
+  if (!strcmp(name, "scalar")) {
+    return classify_scalar;
+  }
+#ifdef CSV_SCAN_X86
+  if (!strcmp(name, "sse2")) {
+    return classify_sse2;
+  }
+  if (!strcmp(name, "avx2") && __builtin_cpu_supports("avx2")) {
+    return classify_avx2;
+  }
+#endif
+  return NULL;
+}
+
+// Returns the name of the fastest implementation the CPU supports.
+static const char *best_name(void) {
+  if (csv_scanner_named("avx2") != NULL) {
+    return "avx2";
+  }
+  if (csv_scanner_named("sse2") != NULL) {
+    return "sse2";
+  }
+  return "scalar";
+}
+
+// The implementations csv_scan and csv_classify use, picked on first use.
+// Racing threads all pick the same ones.
+static csv_scanner *scanner;
+static csv_classifier *classifier;
+
+char *csv_scan(char *s, char *end, unsigned want) {
+  csv_scanner *scan = __atomic_load_n(&scanner, __ATOMIC_RELAXED);
+  if (scan == NULL) {
+    scan = csv_scanner_named(best_name());
+    __atomic_store_n(&scanner, scan, __ATOMIC_RELAXED);
+  }
+  return scan(s, end, want);
+}
+
+void csv_classify(const char *s, const char *end, csv_mask *mask) {
+  csv_classifier *classify = __atomic_load_n(&classifier, __ATOMIC_RELAXED);
+  if (classify == NULL) {
+    classify = csv_classifier_named(best_name());
+    __atomic_store_n(&classifier, classify, __ATOMIC_RELAXED);
+  }
+  if (end - s >= CSV_BLOCK) {
+    classify(s, mask);
+    return;
+  }
+  // Pad the last block of a line with characters of no class, rather than
+  // reading past end.
+  char block[CSV_BLOCK];
+  memset(block, 0, sizeof(block));
+  memcpy(block, s, end - s);
+  classify(block, mask);
+}
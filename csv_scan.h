@@ -0,0 +1,47 @@
+#ifndef CSV_SCAN_H
+#define CSV_SCAN_H
+
+#include <stdint.h> // for uint32_t
+
+// Character classes the CSV parser looks for.
+#define CSV_COMMA 1
+#define CSV_QUOTE 2
+#define CSV_EOL 4 // \r or \n
+
+// Size of a block classified at once.
+#define CSV_BLOCK 32
+
+// Masks of the special characters in a block, with bit i for byte i.
+typedef struct {
+  uint32_t comma;
+  uint32_t quote;
+  uint32_t eol;
+} csv_mask;
+
+// Returns the first character in [s, end) of one of the classes in want, or
+// end if there is none. Uses the fastest implementation the CPU supports.
+// For long spans such as whole lines; fields are found with csv_classify.
+char *csv_scan(char *s, char *end, unsigned want);
+
+// Classifies the block of up to CSV_BLOCK characters in [s, end). Characters
+// at or after end are never read and have no bits set.
+void csv_classify(const char *s, const char *end, csv_mask *mask);
+
+// Returns the bits of mask of the classes in want.
+static inline uint32_t csv_mask_select(const csv_mask *mask,
+                                       unsigned want) {
+  return ((want & CSV_COMMA) ? mask->comma : 0) |
+         ((want & CSV_QUOTE) ? mask->quote : 0) |
+         ((want & CSV_EOL) ? mask->eol : 0);
+}
+
+typedef char *csv_scanner(char *s, char *end, unsigned want);
+typedef void csv_classifier(const char *s, csv_mask *mask);
+
+// Return the implementations of csv_scan and of csv_classify on whole blocks
+// of the given name ("scalar", "sse2" or "avx2"), or NULL if the build or CPU
+// does not support it. For testing them against each other.
+csv_scanner *csv_scanner_named(const char *name);
+csv_classifier *csv_classifier_named(const char *name);
+
+#endif
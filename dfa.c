@@ -0,0 +1,667 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "dfa.h"
+
+#include <ctype.h>   // for isalnum, isalpha, isblank, iscntrl, isdigit, ...
+#include <pthread.h> // for pthread_mutex_lock, pthread_mutex_unlock, ...
+#include <stdint.h>  // for uint32_t
+#include <stdio.h>   // for fprintf, stderr, NULL
+#include <stdlib.h>  // for free, calloc, malloc, realloc, MB_CUR_MAX
+#include <string.h>  // for memcmp, memcpy, memset, strlen, strncmp, strstr
+
+#include "helpers.h" // for hash_bytes
+
+// Patterns needing more NFA states than this are left to regcomp.
+#define NFA_MAX 4096
+// Largest supported count in {m,n}.
+#define REPEAT_MAX 255
+// Number of DFA states to cache. Once reached, the NFA is run directly.
+#define DFA_MAX 1024
+
+typedef struct {
+  uint32_t bits[256 / 32];
+} byteset_t;
+
+static void byteset_add(byteset_t *set, int c) {
+  set->bits[c / 32] |= (uint32_t)1 << (c % 32);
+}
+
+static int byteset_has(const byteset_t *set, int c) {
+  return (set->bits[c / 32] >> (c % 32)) & 1;
+}
+
+enum { NODE_BYTES, NODE_EMPTY, NODE_CAT, NODE_ALT, NODE_REPEAT };
+
+// Parsed regular expression.
+typedef struct {
+  int type;
+  byteset_t bytes;
+  int left, right;
+  int min, max; // max is -1 for no limit.
+} node_t;
+
+typedef struct {
+  const char *p;
+  node_t *nodes;
+  int num_nodes;
+  int capacity;
+  int multibyte;
+} parser_t;
+
+enum { NFA_BYTES, NFA_SPLIT, NFA_MATCH };
+
+typedef struct {
+  int type;
+  byteset_t bytes;
+  int out, out1;
+} nfa_state_t;
+
+// Never modified once published, except for filling in next.
+typedef struct {
+  int accepting;
+  int dead;
+  int next[256]; // -1 if not computed yet. Accessed atomically.
+} dfa_state_t;
+
+struct dfa_s {
+  nfa_state_t *nfa;
+  int num_nfa;
+  int nfa_start;
+  int nfa_match;
+  int set_words;       // Size of a set of NFA states.
+  uint32_t *important; // All NFA states but splits.
+
+  // The DFA states built so far. Matching follows published states and
+  // transitions without locking; the lock is only taken to add missing ones.
+  dfa_state_t **states; // DFA_MAX of them.
+  int start;            // -1 if not built yet. Accessed atomically.
+
+  // Everything below is only used with the lock held.
+  pthread_mutex_t lock;
+  uint32_t *sets; // The set of NFA states of each DFA state.
+  int num_states;
+  int capacity;
+  int *slots; // State + 1, or 0 if free.
+  uint32_t *scratch;
+  uint32_t *overflow;
+  int *stack;
+};
+
+static int new_node(parser_t *parser, int type) {
+  if (parser->num_nodes == parser->capacity) {
+    int capacity = parser->capacity ? parser->capacity * 2 : 64;
+    node_t *nodes = realloc(parser->nodes, capacity * sizeof(*nodes));
+    if (nodes == NULL) {
+      fprintf(stderr, "ERROR: could not allocate regex nodes\n");
+      return -1;
+    }
+    parser->nodes = nodes;
+    parser->capacity = capacity;
+  }
+  node_t *node = &parser->nodes[parser->num_nodes];
+  memset(node, 0, sizeof(*node));
+  node->type = type;
+  node->left = node->right = -1;
+  return parser->num_nodes++;
+}
+
+static int new_pair(parser_t *parser, int type, int left, int right) {
+  int node = new_node(parser, type);
+  if (node >= 0) {
+    parser->nodes[node].left = left;
+    parser->nodes[node].right = right;
+  }
+  return node;
+}
+
+static int in_class(const char *name, size_t len, int c) {
+  static const char *const names[] = {"alnum", "alpha", "blank", "cntrl",
+                                      "digit", "graph", "lower", "print",
+                                      "punct", "space", "upper", "xdigit"};
+  int i = 0;
+  while (i < (int)(sizeof(names) / sizeof(*names)) &&
+         (strlen(names[i]) != len || strncmp(names[i], name, len))) {
+    ++i;
+  }
+  switch (i) {
+  case 0:
+    return isalnum(c) != 0;
+  case 1:
+    return isalpha(c) != 0;
+  case 2:
+    return isblank(c) != 0;
+  case 3:
+    return iscntrl(c) != 0;
+  case 4:
+    return isdigit(c) != 0;
+  case 5:
+    return isgraph(c) != 0;
+  case 6:
+    return islower(c) != 0;
+  case 7:
+    return isprint(c) != 0;
+  case 8:
+    return ispunct(c) != 0;
+  case 9:
+    return isspace(c) != 0;
+  case 10:
+    return isupper(c) != 0;
+  case 11:
+    return isxdigit(c) != 0;
+  default:
+    return -1;
+  }
+}
+
+// Parses a bracket expression after the [.
+static int parse_bracket(parser_t *parser, byteset_t *set) {
+  const char *p = parser->p;
+  int negate = *p == '^';
+  if (negate) {
+    ++p;
+  }
+  for (int first = 1; first || *p != ']'; first = 0) {
+    if (*p == 0 || (p[0] == '[' && (p[1] == '.' || p[1] == '='))) {
+      return 0;
+    }
+    if (p[0] == '[' && p[1] == ':') {
+      const char *end = strstr(p + 2, ":]");
+      // Classes depend on the locale in ways a byte matcher cannot follow.
+      if (end == NULL || parser->multibyte) {
+        return 0;
+      }
+      for (int c = 1; c < 256; ++c) {
+        int has = in_class(p + 2, end - (p + 2), c);
+        if (has < 0) {
+          return 0;
+        }
+        if (has) {
+          byteset_add(set, c);
+        }
+      }
+      p = end + 2;
+      continue;
+    }
+    int lo = (unsigned char)*p++;
+    int hi = lo;
+    if (p[0] == '-' && p[1] != ']' && p[1] != 0) {
+      if (p[1] == '[') {
+        return 0;
+      }
+      hi = (unsigned char)p[1];
+      p += 2;
+    }
+    if (hi < lo || (hi >= 0x80 && parser->multibyte)) {
+      return 0;
+    }
+    for (int c = lo; c <= hi; ++c) {
+      byteset_add(set, c);
+    }
+  }
+  parser->p = p + 1;
+  if (negate) {
+    if (parser->multibyte) {
+      return 0;
+    }
+    for (int i = 0; i < 256 / 32; ++i) {
+      set->bits[i] = ~set->bits[i];
+    }
+  }
+  // Strings end there.
+  set->bits[0] &= ~(uint32_t)1;
+  return 1;
+}
+
+static int parse_alt(parser_t *parser);
+
+static int parse_atom(parser_t *parser) {
+  int c = (unsigned char)*parser->p;
+  if (c == '(') {
+    ++parser->p;
+    int node = parse_alt(parser);
+    if (node < 0 || *parser->p != ')') {
+      return -1;
+    }
+    ++parser->p;
+    return node;
+  }
+  int node = new_node(parser, NODE_BYTES);
+  if (node < 0) {
+    return -1;
+  }
+  byteset_t *set = &parser->nodes[node].bytes;
+  switch (c) {
+  case '[':
+    ++parser->p;
+    return parse_bracket(parser, set) ? node : -1;
+  case '.':
+    // In multibyte locales, . matches a character, not a byte.
+    if (parser->multibyte) {
+      return -1;
+    }
+    for (int i = 1; i < 256; ++i) {
+      byteset_add(set, i);
+    }
+    ++parser->p;
+    return node;
+  case '\\':
+    c = (unsigned char)parser->p[1];
+    // Back references and GNU extensions like \w are left to regcomp.
+    if (c == 0 || c >= 0x80 || isalnum(c)) {
+      return -1;
+    }
+    byteset_add(set, c);
+    parser->p += 2;
+    return node;
+  case '*':
+  case '+':
+  case '?':
+  case '{':
+  case '^':
+  case '$':
+    return -1;
+  default:
+    if (c >= 0x80 && parser->multibyte) {
+      return -1;
+    }
+    byteset_add(set, c);
+    ++parser->p;
+    return node;
+  }
+}
+
+static int parse_count(parser_t *parser, int *count) {
+  if (*parser->p < '0' || *parser->p > '9') {
+    return 0;
+  }
+  *count = 0;
+  while (*parser->p >= '0' && *parser->p <= '9') {
+    *count = *count * 10 + (*parser->p++ - '0');
+    if (*count > REPEAT_MAX) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static int parse_repeat(parser_t *parser) {
+  int node = parse_atom(parser);
+  while (node >= 0) {
+    int min, max;
+    switch (*parser->p) {
+    case '*':
+      min = 0;
+      max = -1;
+      break;
+    case '+':
+      min = 1;
+      max = -1;
+      break;
+    case '?':
+      min = 0;
+      max = 1;
+      break;
+    case '{':
+      ++parser->p;
+      if (!parse_count(parser, &min)) {
+        return -1;
+      }
+      max = min;
+      if (*parser->p == ',') {
+        ++parser->p;
+        max = -1;
+        if (*parser->p != '}' && (!parse_count(parser, &max) || max < min)) {
+          return -1;
+        }
+      }
+      if (*parser->p != '}') {
+        return -1;
+      }
+      break;
+    default:
+      return node;
+    }
+    ++parser->p;
+    int repeat = new_pair(parser, NODE_REPEAT, node, -1);
+    if (repeat < 0) {
+      return -1;
+    }
+    parser->nodes[repeat].min = min;
+    parser->nodes[repeat].max = max;
+    node = repeat;
+  }
+  return node;
+}
+
+static int parse_cat(parser_t *parser) {
+  int node = -1;
+  while (*parser->p != 0 && *parser->p != '|' && *parser->p != ')') {
+    int right = parse_repeat(parser);
+    if (right < 0) {
+      return -1;
+    }
+    node = (node < 0) ? right : new_pair(parser, NODE_CAT, node, right);
+    if (node < 0) {
+      return -1;
+    }
+  }
+  return (node < 0) ? new_node(parser, NODE_EMPTY) : node;
+}
+
+static int parse_alt(parser_t *parser) {
+  int node = parse_cat(parser);
+  while (node >= 0 && *parser->p == '|') {
+    ++parser->p;
+    int right = parse_cat(parser);
+    if (right < 0) {
+      return -1;
+    }
+    node = new_pair(parser, NODE_ALT, node, right);
+  }
+  return node;
+}
+
+static int add_nfa_state(dfa_t *dfa, int type, int out, int out1) {
+  if (dfa->num_nfa == NFA_MAX) {
+    return -1;
+  }
+  nfa_state_t *state = &dfa->nfa[dfa->num_nfa];
+  memset(state, 0, sizeof(*state));
+  state->type = type;
+  state->out = out;
+  state->out1 = out1;
+  return dfa->num_nfa++;
+}
+
+// Builds the NFA states for a node, continuing at next, and returns the
+// first of them (Thompson's construction, back to front).
+static int compile_node(dfa_t *dfa, const parser_t *parser, int node,
+                        int next) {
+  const node_t *n = &parser->nodes[node];
+  int start, body;
+  switch (n->type) {
+  case NODE_BYTES:
+    start = add_nfa_state(dfa, NFA_BYTES, next, -1);
+    if (start >= 0) {
+      dfa->nfa[start].bytes = n->bytes;
+    }
+    return start;
+  case NODE_EMPTY:
+    return next;
+  case NODE_CAT:
+    start = compile_node(dfa, parser, n->right, next);
+    return (start < 0) ? -1 : compile_node(dfa, parser, n->left, start);
+  case NODE_ALT:
+    start = compile_node(dfa, parser, n->left, next);
+    body = compile_node(dfa, parser, n->right, next);
+    return (start < 0 || body < 0) ? -1
+                                   : add_nfa_state(dfa, NFA_SPLIT, start, body);
+  default:
+    start = next;
+    if (n->max < 0) {
+      start = add_nfa_state(dfa, NFA_SPLIT, -1, next);
+      body = (start < 0) ? -1 : compile_node(dfa, parser, n->left, start);
+      if (body < 0) {
+        return -1;
+      }
+      dfa->nfa[start].out = body;
+    }
+    for (int i = n->min; i < n->max; ++i) {
+      body = compile_node(dfa, parser, n->left, start);
+      start = (body < 0) ? -1 : add_nfa_state(dfa, NFA_SPLIT, body, next);
+      if (start < 0) {
+        return -1;
+      }
+    }
+    for (int i = 0; i < n->min; ++i) {
+      start = compile_node(dfa, parser, n->left, start);
+      if (start < 0) {
+        return -1;
+      }
+    }
+    return start;
+  }
+}
+
+void dfa_free(dfa_t *dfa) {
+  if (dfa == NULL) {
+    return;
+  }
+  pthread_mutex_destroy(&dfa->lock);
+  free(dfa->stack);
+  free(dfa->overflow);
+  free(dfa->scratch);
+  free(dfa->slots);
+  free(dfa->sets);
+  if (dfa->states != NULL) {
+    for (int i = 0; i < dfa->num_states; ++i) {
+      free(dfa->states[i]);
+    }
+  }
+  free(dfa->states);
+  free(dfa->important);
+  free(dfa->nfa);
+  free(dfa);
+}
+
+dfa_t *dfa_compile(const char *pattern) {
+  parser_t parser;
+  memset(&parser, 0, sizeof(parser));
+  parser.p = pattern;
+  parser.multibyte = MB_CUR_MAX > 1;
+  int root = parse_alt(&parser);
+  if (root < 0 || *parser.p != 0) {
+    free(parser.nodes);
+    return NULL;
+  }
+
+  dfa_t *dfa = calloc(1, sizeof(*dfa));
+  if (dfa == NULL) {
+    fprintf(stderr, "ERROR: could not allocate DFA\n");
+    free(parser.nodes);
+    return NULL;
+  }
+  pthread_mutex_init(&dfa->lock, NULL);
+  dfa->start = -1;
+  dfa->nfa = malloc(NFA_MAX * sizeof(*dfa->nfa));
+  if (dfa->nfa != NULL) {
+    dfa->nfa_match = add_nfa_state(dfa, NFA_MATCH, -1, -1);
+    dfa->nfa_start = compile_node(dfa, &parser, root, dfa->nfa_match);
+  }
+  free(parser.nodes);
+  if (dfa->nfa == NULL || dfa->nfa_start < 0) {
+    dfa_free(dfa);
+    return NULL;
+  }
+
+  dfa->set_words = (dfa->num_nfa + 31) / 32;
+  dfa->important = calloc(dfa->set_words, sizeof(uint32_t));
+  dfa->scratch = malloc(dfa->set_words * sizeof(uint32_t));
+  dfa->overflow = malloc(dfa->set_words * sizeof(uint32_t));
+  dfa->stack = malloc((2 * dfa->num_nfa + 1) * sizeof(int));
+  dfa->slots = calloc(2 * DFA_MAX, sizeof(int));
+  dfa->states = calloc(DFA_MAX, sizeof(*dfa->states));
+  if (dfa->important == NULL || dfa->scratch == NULL ||
+      dfa->overflow == NULL || dfa->stack == NULL || dfa->slots == NULL ||
+      dfa->states == NULL) {
+    fprintf(stderr, "ERROR: could not allocate DFA\n");
+    dfa_free(dfa);
+    return NULL;
+  }
+  for (int i = 0; i < dfa->num_nfa; ++i) {
+    if (dfa->nfa[i].type != NFA_SPLIT) {
+      dfa->important[i / 32] |= (uint32_t)1 << (i % 32);
+    }
+  }
+  return dfa;
+}
+
+// Adds an NFA state and all states reachable from it without reading a byte.
+static void add_closure(dfa_t *dfa, uint32_t *set, int state) {
+  int top = 0;
+  dfa->stack[top++] = state;
+  while (top > 0) {
+    state = dfa->stack[--top];
+    if ((set[state / 32] >> (state % 32)) & 1) {
+      continue;
+    }
+    set[state / 32] |= (uint32_t)1 << (state % 32);
+    if (dfa->nfa[state].type == NFA_SPLIT) {
+      dfa->stack[top++] = dfa->nfa[state].out;
+      dfa->stack[top++] = dfa->nfa[state].out1;
+    }
+  }
+  // Splits only matter while following them.
+  for (int i = 0; i < dfa->set_words; ++i) {
+    set[i] &= dfa->important[i];
+  }
+}
+
+// Returned by find_state if all DFA_MAX states are in use.
+#define DFA_FULL (-2)
+
+// Returns the DFA state for the set of NFA states in scratch, adding it if
+// new. Returns DFA_FULL if there is no room for it, or -1 on failure.
+static int find_state(dfa_t *dfa) {
+  size_t set_size = dfa->set_words * sizeof(uint32_t);
+  uint64_t hash = hash_bytes((const char *)dfa->scratch, set_size);
+  int j = hash & (2 * DFA_MAX - 1);
+  for (; dfa->slots[j] != 0; j = (j + 1) & (2 * DFA_MAX - 1)) {
+    int state = dfa->slots[j] - 1;
+    if (!memcmp(dfa->sets + state * dfa->set_words, dfa->scratch, set_size)) {
+      return state;
+    }
+  }
+  if (dfa->num_states == DFA_MAX) {
+    return DFA_FULL;
+  }
+  if (dfa->num_states == dfa->capacity) {
+    int capacity = dfa->capacity ? dfa->capacity * 2 : 16;
+    uint32_t *sets = realloc(dfa->sets, capacity * set_size);
+    if (sets == NULL) {
+      fprintf(stderr, "ERROR: could not allocate DFA states\n");
+      return -1;
+    }
+    dfa->sets = sets;
+    dfa->capacity = capacity;
+  }
+  dfa_state_t *s = malloc(sizeof(*s));
+  if (s == NULL) {
+    fprintf(stderr, "ERROR: could not allocate DFA states\n");
+    return -1;
+  }
+  s->accepting =
+      (dfa->scratch[dfa->nfa_match / 32] >> (dfa->nfa_match % 32)) & 1;
+  s->dead = 1;
+  for (int i = 0; i < dfa->set_words; ++i) {
+    if (dfa->scratch[i] != 0) {
+      s->dead = 0;
+    }
+  }
+  for (int c = 0; c < 256; ++c) {
+    s->next[c] = -1;
+  }
+  int state = dfa->num_states++;
+  memcpy(dfa->sets + state * dfa->set_words, dfa->scratch, set_size);
+  // Only published to readers by the release stores of start and next.
+  dfa->states[state] = s;
+  dfa->slots[j] = state + 1;
+  return state;
+}
+
+// Computes the NFA states following the given ones on a byte into scratch.
+static void next_set(dfa_t *dfa, const uint32_t *set, int c) {
+  memset(dfa->scratch, 0, dfa->set_words * sizeof(uint32_t));
+  for (int i = 0; i < dfa->set_words; ++i) {
+    for (uint32_t bits = set[i]; bits != 0; bits &= bits - 1) {
+      const nfa_state_t *nfa = &dfa->nfa[i * 32 + __builtin_ctz(bits)];
+      if (nfa->type == NFA_BYTES && byteset_has(&nfa->bytes, c)) {
+        add_closure(dfa, dfa->scratch, nfa->out);
+      }
+    }
+  }
+}
+
+static int start_state(dfa_t *dfa) {
+  int start = __atomic_load_n(&dfa->start, __ATOMIC_ACQUIRE);
+  if (start >= 0) {
+    return start;
+  }
+  pthread_mutex_lock(&dfa->lock);
+  start = dfa->start;
+  if (start < 0) {
+    memset(dfa->scratch, 0, dfa->set_words * sizeof(uint32_t));
+    add_closure(dfa, dfa->scratch, dfa->nfa_start);
+    start = find_state(dfa);
+    if (start >= 0) {
+      __atomic_store_n(&dfa->start, start, __ATOMIC_RELEASE);
+    }
+  }
+  pthread_mutex_unlock(&dfa->lock);
+  return start;
+}
+
+// Runs the NFA directly from a DFA state over the rest of the string, once
+// there is no room for more DFA states. Called with the lock held.
+static int match_nfa(dfa_t *dfa, int state, const unsigned char *p) {
+  size_t set_size = dfa->set_words * sizeof(uint32_t);
+  memcpy(dfa->overflow, dfa->sets + state * dfa->set_words, set_size);
+  int alive = 1;
+  for (; *p != 0 && alive; ++p) {
+    next_set(dfa, dfa->overflow, *p);
+    memcpy(dfa->overflow, dfa->scratch, set_size);
+    alive = 0;
+    for (int i = 0; i < dfa->set_words; ++i) {
+      if (dfa->overflow[i] != 0) {
+        alive = 1;
+      }
+    }
+  }
+  return (dfa->overflow[dfa->nfa_match / 32] >> (dfa->nfa_match % 32)) & 1;
+}
+
+// Computes, caches and publishes the transition of a DFA state on the byte at
+// p. Returns the next state, or -1 on failure; if the DFA is full, matches the
+// rest of the string right away and returns DFA_FULL with the result in
+// *matched.
+static int step(dfa_t *dfa, int state, const unsigned char *p, int *matched) {
+  pthread_mutex_lock(&dfa->lock);
+  // Another thread may have added the transition meanwhile.
+  int next = dfa->states[state]->next[*p];
+  if (next < 0) {
+    next_set(dfa, dfa->sets + state * dfa->set_words, *p);
+    next = find_state(dfa);
+    if (next >= 0) {
+      __atomic_store_n(&dfa->states[state]->next[*p], next, __ATOMIC_RELEASE);
+    } else if (next == DFA_FULL) {
+      *matched = match_nfa(dfa, state, p);
+    }
+  }
+  pthread_mutex_unlock(&dfa->lock);
+  return next;
+}
+
+int dfa_match(dfa_t *dfa, const char *s) {
+  int state = start_state(dfa);
+  if (state < 0) {
+    return 0;
+  }
+  const dfa_state_t *current = dfa->states[state];
+  for (const unsigned char *p = (const unsigned char *)s;
+       *p != 0 && !current->dead; ++p) {
+    int next = __atomic_load_n(&current->next[*p], __ATOMIC_ACQUIRE);
+    if (next < 0) {
+      int matched = 0;
+      next = step(dfa, state, p, &matched);
+      if (next == DFA_FULL) {
+        return matched;
+      }
+      if (next < 0) {
+        return 0;
+      }
+    }
+    state = next;
+    current = dfa->states[state];
+  }
+  return current->accepting;
+}
@@ -0,0 +1,23 @@
+#ifndef DFA_H
+#define DFA_H
+
+// Matcher for a subset of POSIX extended regular expressions, built as a
+// Thompson NFA from which DFA states are made lazily and cached. Matching
+// takes time linear in the length of the string.
+
+typedef struct dfa_s dfa_t;
+
+// Compiles a regular expression to be matched against whole strings, as if
+// it were ^(pattern)$. Returns NULL if the pattern uses anything not
+// supported (anchors, back references, GNU extensions, multibyte specifics),
+// in which case regcomp has to be used instead. The pattern is expected to
+// have been validated by regcomp already.
+dfa_t *dfa_compile(const char *pattern);
+
+// Returns whether the whole string matches. Safe to call from multiple
+// threads at once; only adding a missing DFA state or transition takes a lock.
+int dfa_match(dfa_t *dfa, const char *s);
+
+void dfa_free(dfa_t *dfa);
+
+#endif
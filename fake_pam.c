@@ -0,0 +1,289 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "fake_pam.h"
+
+#include <security/pam_appl.h>    // for pam_response, pam_message, PAM_...
+#include <security/pam_ext.h>     // for pam_syslog
+#include <security/pam_modules.h> // for pam_handle_t, pam_get_data, ...
+#include <stdarg.h>               // for va_end, va_list, va_start
+#include <stdio.h>                // for NULL, fclose, fopen, fread, perror, ...
+#include <stdlib.h>               // for free, calloc, realloc
+#include <string.h>               // for strcmp, strlen, strncmp, strchr, ...
+#include <time.h>                 // for clock_gettime, timespec
+
+#include "helpers.h" // for d0_strndup, d0_strlcpy, randuniform
+
+#define ANSWER_MAX 1024
+
+long long fake_pam_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// The parts of libpam the modules use. Visible, so that modules loaded with
+// dlopen use them too.
+
+int pam_get_item(const pam_handle_t *pamh, int item_type, const void **item)
+    __attribute__((__visibility__("default")));
+int pam_get_item(const pam_handle_t *pamh, int item_type, const void **item) {
+  if (item_type != PAM_CONV) {
+    return PAM_BAD_ITEM;
+  }
+  *item = &pamh->conv;
+  return PAM_SUCCESS;
+}
+
+int pam_get_user(pam_handle_t *pamh, const char **user,
+                 const char *prompt __attribute__((unused)))
+    __attribute__((__visibility__("default")));
+int pam_get_user(pam_handle_t *pamh, const char **user,
+                 const char *prompt __attribute__((unused))) {
+  *user = pamh->user;
+  return PAM_SUCCESS;
+}
+
+const char *pam_strerror(pam_handle_t *pamh __attribute__((unused)),
+                         int errnum)
+    __attribute__((__visibility__("default")));
+const char *pam_strerror(pam_handle_t *pamh __attribute__((unused)),
+                         int errnum) {
+  return (errnum == PAM_SUCCESS) ? "success" : "error";
+}
+
+int pam_set_data(pam_handle_t *pamh, const char *module_data_name, void *data,
+                 void (*cleanup)(pam_handle_t *pamh, void *data,
+                                 int error_status))
+    __attribute__((__visibility__("default")));
+int pam_set_data(pam_handle_t *pamh, const char *module_data_name, void *data,
+                 void (*cleanup)(pam_handle_t *pamh, void *data,
+                                 int error_status)) {
+  for (int i = 0; i < pamh->num_data; ++i) {
+    if (!strcmp(pamh->data[i].name, module_data_name)) {
+      if (pamh->data[i].cleanup != NULL) {
+        pamh->data[i].cleanup(pamh, pamh->data[i].data, PAM_DATA_REPLACE);
+      }
+      pamh->data[i].data = data;
+      pamh->data[i].cleanup = cleanup;
+      return PAM_SUCCESS;
+    }
+  }
+  if (pamh->num_data == FAKE_PAM_DATA_MAX) {
+    return PAM_BUF_ERR;
+  }
+  char *name = d0_strndup(module_data_name, strlen(module_data_name));
+  if (name == NULL) {
+    return PAM_BUF_ERR;
+  }
+  pamh->data[pamh->num_data].name = name;
+  pamh->data[pamh->num_data].data = data;
+  pamh->data[pamh->num_data].cleanup = cleanup;
+  ++pamh->num_data;
+  return PAM_SUCCESS;
+}
+
+int pam_get_data(const pam_handle_t *pamh, const char *module_data_name,
+                 const void **data)
+    __attribute__((__visibility__("default")));
+int pam_get_data(const pam_handle_t *pamh, const char *module_data_name,
+                 const void **data) {
+  for (int i = 0; i < pamh->num_data; ++i) {
+    if (!strcmp(pamh->data[i].name, module_data_name)) {
+      *data = pamh->data[i].data;
+      return PAM_SUCCESS;
+    }
+  }
+  return PAM_NO_MODULE_DATA;
+}
+
+void pam_syslog(const pam_handle_t *pamh __attribute__((unused)),
+                int priority __attribute__((unused)), const char *fmt, ...)
+    __attribute__((__visibility__("default")));
+void pam_syslog(const pam_handle_t *pamh __attribute__((unused)),
+                int priority __attribute__((unused)), const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  vfprintf(stderr, fmt, ap);
+  va_end(ap);
+  fputc('\n', stderr);
+}
+
+static int converse(int num_msg, const struct pam_message **msg,
+                    struct pam_response **resp, void *appdata_ptr) {
+  fake_pam_script_t *script = appdata_ptr;
+  long long start = fake_pam_now_ns();
+  if (script->first_prompt == 0) {
+    script->first_prompt = start;
+  }
+  *resp = calloc(num_msg, sizeof(**resp));
+  if (*resp == NULL) {
+    return PAM_BUF_ERR;
+  }
+  for (int i = 0; i < num_msg; ++i) {
+    if (msg[i]->msg_style != PAM_PROMPT_ECHO_ON) {
+      continue;
+    }
+    const char *prompt = msg[i]->msg;
+    if (!strncmp(prompt, "Incorrect. ", 11)) {
+      prompt += 11;
+    }
+    char answer[ANSWER_MAX];
+    if (!script->oracle->answer(script->oracle_state, prompt, answer,
+                                sizeof(answer))) {
+      ++script->unknown;
+      script->answered_wrong = 1;
+      answer[0] = 0;
+    }
+    if (randuniform(&script->rng) >= script->p_correct) {
+      script->answered_wrong = 1;
+      d0_strlcpy(answer, "wrong", sizeof(answer));
+    }
+    (*resp)[i].resp = d0_strndup(answer, strlen(answer));
+  }
+  script->in_conversation += fake_pam_now_ns() - start;
+  return PAM_SUCCESS;
+}
+
+void fake_pam_start(pam_handle_t *pamh, const char *user,
+                    fake_pam_script_t *script) {
+  pamh->user = user;
+  pamh->conv.conv = converse;
+  pamh->conv.appdata_ptr = script;
+  pamh->num_data = 0;
+  script->first_prompt = 0;
+  script->in_conversation = 0;
+  script->answered_wrong = 0;
+  script->start = fake_pam_now_ns();
+}
+
+void fake_pam_end(pam_handle_t *pamh) {
+  for (int i = 0; i < pamh->num_data; ++i) {
+    if (pamh->data[i].cleanup != NULL) {
+      pamh->data[i].cleanup(pamh, pamh->data[i].data, PAM_SUCCESS);
+    }
+    free(pamh->data[i].name);
+  }
+  pamh->num_data = 0;
+}
+
+static char *read_file(const char *name) {
+  FILE *f = fopen(name, "r");
+  if (f == NULL) {
+    perror(name);
+    return NULL;
+  }
+  size_t size = 0;
+  char *text = NULL;
+  for (;;) {
+    char *new_text = realloc(text, size + 4097);
+    if (new_text == NULL) {
+      free(text);
+      fclose(f);
+      return NULL;
+    }
+    text = new_text;
+    size_t got = fread(text + size, 1, 4096, f);
+    size += got;
+    if (got < 4096) {
+      break;
+    }
+  }
+  fclose(f);
+  text[size] = 0;
+  return text;
+}
+
+int fake_pam_parse_config(const char *name, const char *module,
+                          fake_pam_config_t *config) {
+  config->text = read_file(name);
+  if (config->text == NULL) {
+    return -1;
+  }
+  // Join continued lines and drop comments.
+  char *out = config->text;
+  int comment = 0;
+  for (const char *in = config->text; *in; ++in) {
+    if (*in == '\\' && in[1] == '\n') {
+      *out++ = ' ';
+      ++in;
+      continue;
+    }
+    if (*in == '#') {
+      comment = 1;
+    }
+    if (*in == '\n') {
+      comment = 0;
+    }
+    if (!comment) {
+      *out++ = *in;
+    }
+  }
+  *out = 0;
+
+  char *line_save;
+  for (char *line = strtok_r(config->text, "\n", &line_save); line != NULL;
+       line = strtok_r(NULL, "\n", &line_save)) {
+    char *save;
+    const char *words[FAKE_PAM_ARGS_MAX + 3];
+    int num_words = 0;
+    for (char *word = strtok_r(line, " \t", &save);
+         word != NULL && num_words < FAKE_PAM_ARGS_MAX + 3;
+         word = strtok_r(NULL, " \t", &save)) {
+      words[num_words++] = word;
+    }
+    // Skip over a bracketed control value, which may contain spaces.
+    int module_word = 2;
+    if (num_words > 1 && words[1][0] == '[') {
+      while (module_word < num_words &&
+             strchr(words[module_word - 1], ']') == NULL) {
+        ++module_word;
+      }
+    }
+    if (module_word >= num_words || strcmp(words[0], "auth") != 0) {
+      continue;
+    }
+    const char *base = strrchr(words[module_word], '/');
+    base = (base == NULL) ? words[module_word] : base + 1;
+    if (strcmp(base, module) != 0) {
+      continue;
+    }
+    config->num_args = num_words - module_word - 1;
+    for (int i = 0; i < config->num_args; ++i) {
+      config->args[i] = words[module_word + 1 + i];
+    }
+    return 1;
+  }
+  free(config->text);
+  return 0;
+}
+
+void fake_pam_free_config(fake_pam_config_t *config) { free(config->text); }
+
+int fake_pam_find_users(const fake_pam_config_t *config, char **users) {
+  int num_users = 0;
+  for (int i = 0; i < config->num_args; ++i) {
+    const char *dot = strchr(config->args[i], '.');
+    if (dot == NULL || dot == config->args[i]) {
+      continue;
+    }
+    size_t len = dot - config->args[i];
+    int known = 0;
+    for (int j = 0; j < num_users; ++j) {
+      known |= strlen(users[j]) == len &&
+               !strncmp(users[j], config->args[i], len);
+    }
+    if (!known && num_users < FAKE_PAM_USERS_MAX) {
+      users[num_users] = d0_strndup(config->args[i], len);
+      if (users[num_users] != NULL) {
+        ++num_users;
+      }
+    }
+  }
+  if (num_users == 0) {
+    users[num_users] = d0_strndup("user", 4);
+    if (users[num_users] != NULL) {
+      ++num_users;
+    }
+  }
+  return num_users;
+}
@@ -0,0 +1,87 @@
+#ifndef FAKE_PAM_H
+#define FAKE_PAM_H
+
+#include <security/pam_appl.h> // for pam_conv, pam_handle_t
+#include <stddef.h>             // for size_t
+
+#include "helpers.h" // for random_t
+
+// Stands in for libpam in the benchmarks, which call the module directly.
+
+#define FAKE_PAM_DATA_MAX 8
+#define FAKE_PAM_ARGS_MAX 256
+#define FAKE_PAM_USERS_MAX 64
+
+struct pam_handle {
+  const char *user;
+  struct pam_conv conv;
+  struct {
+    char *name;
+    void *data;
+    void (*cleanup)(pam_handle_t *pamh, void *data, int error_status);
+  } data[FAKE_PAM_DATA_MAX];
+  int num_data;
+};
+
+typedef struct oracle_s oracle_t;
+
+// The conversation of the benchmarks, answering correctly with a given
+// probability.
+typedef struct {
+  const oracle_t *oracle;
+  const void *oracle_state;
+  double p_correct;
+  random_t rng;
+  // Times in nanoseconds, reset by fake_pam_start.
+  long long start;
+  long long first_prompt; // 0 if there was no prompt.
+  long long in_conversation;
+  int answered_wrong; // Whether any answer was wrong or unknown.
+  long unknown;       // Questions the oracle could not answer, in total.
+} fake_pam_script_t;
+
+long long fake_pam_now_ns(void);
+
+// Like pam_start, with a conversation following the script.
+void fake_pam_start(pam_handle_t *pamh, const char *user,
+                    fake_pam_script_t *script);
+
+// Like pam_end: cleans up the module data.
+void fake_pam_end(pam_handle_t *pamh);
+
+// The arguments of the auth line of a PAM config file using a module.
+typedef struct {
+  char *text;
+  const char *args[FAKE_PAM_ARGS_MAX];
+  int num_args;
+} fake_pam_config_t;
+
+// Finds the auth line using the module of the given file name (e.g.
+// pam_math.so). Returns 1 if found, 0 if not, and -1 on error.
+int fake_pam_parse_config(const char *name, const char *module,
+                          fake_pam_config_t *config);
+
+void fake_pam_free_config(fake_pam_config_t *config);
+
+// Finds the users the arguments configure, or "user" if none. Returns their
+// number; the names are to be freed.
+int fake_pam_find_users(const fake_pam_config_t *config, char **users);
+
+// Answers the questions of a module, for the conversation of the benchmarks.
+struct oracle_s {
+  const char *module_name;
+  // Prepares answering the questions of a user with the given module
+  // arguments. Returns NULL on failure.
+  void *(*init)(const char *user, int argc, const char **argv);
+  // Writes the correct answer to a question, as prompted but without the
+  // "Incorrect. " prefix, to buf. Returns 0 if the answer is not known.
+  // Safe to call from multiple threads at once.
+  int (*answer)(const void *state, const char *prompt, char *buf,
+                size_t size);
+  void (*free)(void *state);
+};
+
+extern const oracle_t math_oracle;
+extern const oracle_t questions_file_oracle;
+
+#endif
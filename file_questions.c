@@ -1,39 +1,103 @@
-#define _POSIX_C_SOURCE 1
+#define _POSIX_C_SOURCE 200809L
 
 #include "questions.h" // for config_t, answer_state_t, build_config, check...
 
-#include <limits.h>  // for PATH_MAX
+#include <float.h>   // for DBL_MAX
+#include <limits.h>  // for INT_MAX
 #include <regex.h>   // for regcomp, regerror, regexec, regfree, REG_EXTE...
-#include <stdio.h>   // for NULL, fprintf, sscanf, stderr, snprintf, fclose
-#include <stdlib.h>  // for free, malloc
-#include <string.h>  // for strlen, strcmp, strncmp
+#include <stdio.h>   // for NULL, fprintf, sscanf, stderr, snprintf
+#include <stdlib.h>  // for free, calloc, malloc, realloc
+#include <string.h>  // for strlen, strcmp, strncmp, strchr
 #include <strings.h> // for strcasecmp
+#include <unistd.h>  // for sysconf, _SC_NPROCESSORS_ONLN
 
-#include "csv.h"     // for csv_read, csv_start, csv_buf
-#include "helpers.h" // for d0_strlcpy
+#include "alias.h"        // for alias_build, alias_pick, alias_t
+#include "arena.h"        // for arena_alloc, arena_asprintf, arena_strndup
+#include "bank.h"         // for bank_t, bank_string, bank_group, bank_row
+#include "dfa.h"          // for dfa_compile, dfa_free, dfa_match, dfa_t
+#include "helpers.h"      // for d0_strlcpy, d0_strndup, randint, random_t
+#include "options.h"      // for for_each_option
+#include "parallel.h"     // for THREADS_MAX
+#include "source_cache.h" // for source_t, source_group_t, source_row_t, ...
 
 #define REGERROR_MAX 1024
 #define MATCHER_MAX 1024
-#define CSV_MAX 4096
-
-#ifndef PATH_MAX
-#define PATH_MAX _POSIX_PATH_MAX
-#endif
+#define FILES_MAX 4096
+#define THREADS_DEFAULT 4
+// Copies of the matcher when it needs regexec, as glibc serializes regexec
+// calls on the same regex_t.
+#define MATCHERS_MAX 4
 
 struct config_s {
   int questions; // Used by pam_math.c.
   int attempts;  // Used by pam_math.c.
-  char filename[PATH_MAX];
-  regex_t matcher;
+  int batch;     // Ask all questions in one conv call.
+  int stats;     // Log per-phase timings to syslog.
+  char *counters; // Path of the counters file, or NULL.
+  char files[FILES_MAX]; // Colon separated files and directories.
+  dfa_t *dfa; // NULL if the matcher needs regexec.
+  // Copies of the matcher, which concurrent logins take turns using. Only
+  // the first one if the DFA is used.
+  regex_t matchers[MATCHERS_MAX];
+  int num_matchers;
+  unsigned next_matcher;
   int ignore_case;
+  int threads;
 };
 
+const char module_name[] = "pam_questions_file";
+
 int num_questions(config_t *config) { return config->questions; }
 int num_attempts(config_t *config) { return config->attempts; }
+int batch_prompts(config_t *config) { return config->batch; }
+int collect_stats(config_t *config) { return config->stats; }
+const char *counters_file(config_t *config) { return config->counters; }
 
 #define STRINGIFY2(s) #s
 #define STRINGIFY(s) STRINGIFY2(s)
 
+typedef struct {
+  config_t *config;
+  char matcher[MATCHER_MAX];
+  char file_scan_fmt[32];
+  char matcher_scan_fmt[32];
+} options_t;
+
+static void apply_option(void *ctx, const char *field, const char *arg) {
+  options_t *options = ctx;
+  if (sscanf(field, "questions=%d", &options->config->questions) == 1) {
+    return;
+  }
+  if (sscanf(field, "attempts=%d", &options->config->attempts) == 1) {
+    return;
+  }
+  if (sscanf(field, "batch=%d", &options->config->batch) == 1) {
+    return;
+  }
+  if (sscanf(field, "stats=%d", &options->config->stats) == 1) {
+    return;
+  }
+  if (!strncmp(field, "counters=", 9)) {
+    free(options->config->counters);
+    options->config->counters = d0_strndup(field + 9, strlen(field + 9));
+    return;
+  }
+  if (sscanf(field, options->file_scan_fmt, options->config->files) == 1) {
+    return;
+  }
+  if (sscanf(field, options->matcher_scan_fmt, options->matcher) == 1) {
+    return;
+  }
+  if (sscanf(field, "ignore_case=%d", &options->config->ignore_case) == 1) {
+    return;
+  }
+  if (sscanf(field, "threads=%d", &options->config->threads) == 1) {
+    return;
+  }
+  // TODO edit distance?
+  fprintf(stderr, "Unexpected option in config: %s\n", arg);
+}
+
 config_t *build_config(const char *user, int argc, const char **argv) {
   config_t *config = malloc(sizeof(config_t));
   if (config == NULL) {
@@ -42,65 +106,66 @@ config_t *build_config(const char *user, int argc, const char **argv) {
   }
   config->questions = 3;
   config->attempts = 3;
-  d0_strlcpy(config->filename, "/usr/lib/pam_math/questions.csv",
-             sizeof(config->filename));
+  config->batch = 0;
+  config->stats = 0;
+  config->counters = NULL;
+  d0_strlcpy(config->files, "/usr/lib/pam_math/questions.csv",
+             sizeof(config->files));
   config->ignore_case = 0;
-  size_t userlen = strlen(user);
-  char matcher[MATCHER_MAX] = ".*";
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  config->threads =
+      (cpus < 1) ? 1 : (cpus > THREADS_DEFAULT) ? THREADS_DEFAULT : cpus;
+  options_t options;
+  options.config = config;
+  d0_strlcpy(options.matcher, ".*", sizeof(options.matcher));
 
-  char file_scan_fmt[32];
-  snprintf(file_scan_fmt, sizeof(file_scan_fmt), "file=%%%ds", PATH_MAX - 1);
-  file_scan_fmt[sizeof(file_scan_fmt) - 1] = 0;
-  char matcher_scan_fmt[32];
-  snprintf(matcher_scan_fmt, sizeof(matcher_scan_fmt), "match=%%%ds",
-           MATCHER_MAX - 1);
-  matcher_scan_fmt[sizeof(matcher_scan_fmt) - 1] = 0;
-
-  for (int i = 0; i < argc; ++i) {
-    const char *arg = argv[i];
-    const char *field;
-    if (arg[0] == '.') {
-      field = arg + 1;
-    } else if (!strncmp(arg, user, userlen) && arg[userlen] == '.') {
-      field = arg + userlen + 1;
-    } else {
-      continue;
-    }
-    if (sscanf(field, "questions=%d", &config->questions) == 1) {
-      continue;
-    }
-    if (sscanf(field, "attempts=%d", &config->attempts) == 1) {
-      continue;
-    }
-    if (sscanf(field, file_scan_fmt, config->filename) == 1) {
-      continue;
-    }
-    if (sscanf(field, matcher_scan_fmt, matcher) == 1) {
-      continue;
-    }
-    if (sscanf(field, "ignore_case=%d", &config->ignore_case) == 1) {
-      continue;
-    }
-    // TODO edit distance?
-    fprintf(stderr, "Unexpected option in config: %s\n", arg);
+  snprintf(options.file_scan_fmt, sizeof(options.file_scan_fmt), "file=%%%ds",
+           FILES_MAX - 1);
+  options.file_scan_fmt[sizeof(options.file_scan_fmt) - 1] = 0;
+  snprintf(options.matcher_scan_fmt, sizeof(options.matcher_scan_fmt),
+           "match=%%%ds", MATCHER_MAX - 1);
+  options.matcher_scan_fmt[sizeof(options.matcher_scan_fmt) - 1] = 0;
+
+  for_each_option(user, argc, argv, apply_option, &options);
+
+  if (*config->files == 0) {
+    config->questions = 0;
+  }
+  if (config->threads < 1) {
+    config->threads = 1;
+  }
+  if (config->threads > THREADS_MAX) {
+    config->threads = THREADS_MAX;
   }
 
   char fullmatcher[MATCHER_MAX + 4];
-  snprintf(fullmatcher, sizeof(fullmatcher), "^(%s)$", matcher);
+  snprintf(fullmatcher, sizeof(fullmatcher), "^(%s)$", options.matcher);
   fullmatcher[sizeof(fullmatcher) - 1] = 0;
+  config->num_matchers = 0;
   int reg_error =
-      regcomp(&config->matcher, fullmatcher, REG_EXTENDED | REG_NOSUB);
+      regcomp(&config->matchers[0], fullmatcher, REG_EXTENDED | REG_NOSUB);
   if (reg_error != 0) {
     char errbuf[REGERROR_MAX];
     *errbuf = 0;
-    regerror(reg_error, &config->matcher, errbuf, sizeof(errbuf));
-    fprintf(stderr, "Failed to compile regex %s: %s\n", matcher, errbuf);
+    regerror(reg_error, &config->matchers[0], errbuf, sizeof(errbuf));
+    fprintf(stderr, "Failed to compile regex %s: %s\n", options.matcher,
+            errbuf);
+    free(config->counters);
     free(config);
     return NULL;
   }
-
-  if (*config->filename == 0) {
-    config->questions = 0;
+  config->num_matchers = 1;
+  config->next_matcher = 0;
+  config->dfa = dfa_compile(options.matcher);
+  if (config->dfa == NULL) {
+    for (; config->num_matchers < MATCHERS_MAX; ++config->num_matchers) {
+      if (regcomp(&config->matchers[config->num_matchers], fullmatcher,
+                  REG_EXTENDED | REG_NOSUB) != 0) {
+        // Cannot happen, as it compiled before. Logins share the others.
+        fprintf(stderr, "ERROR: could not recompile regex\n");
+        break;
+      }
+    }
   }
 
   return config;
@@ -110,7 +175,11 @@ void free_config(config_t *config) {
   if (config == NULL) {
     return;
   }
-  regfree(&config->matcher);
+  dfa_free(config->dfa);
+  for (int i = 0; i < config->num_matchers; ++i) {
+    regfree(&config->matchers[i]);
+  }
+  free(config->counters);
   free(config);
 }
 
@@ -119,111 +188,458 @@ struct answer_state_s {
   int ignore_case;
 };
 
-char *make_question(config_t *config, answer_state_t **answer_state) {
-  // Read questions file.
-  FILE *questions = fopen(config->filename, "r");
-  if (questions == NULL) {
-    perror("ERROR: could not open questions file");
+char *make_question(config_t *config, random_t *rng, arena_t *arena,
+                    answer_state_t **answer_state) {
+  char *question;
+  if (!make_questions(config, rng, arena, 1, &question, answer_state)) {
     return NULL;
   }
+  return question;
+}
 
-  // Identify CSV columns.
-  int match_col = -1, question_col = -1, answer_col = -1;
-  char buf[CSV_MAX];
-  fgets(buf, sizeof(buf), questions); // Skip CSV header.
-  csv_buf csvbuf;
-  csv_start(buf, &csvbuf);
-  for (int col = 0;; ++col) {
-    char *col_name = csv_read(&csvbuf);
-    if (col_name == NULL) {
-      break;
-    } else if (!strcasecmp(col_name, "match")) {
-      match_col = col;
-    } else if (!strcasecmp(col_name, "question")) {
-      question_col = col;
-    } else if (!strcasecmp(col_name, "answer")) {
-      answer_col = col;
-    }
-    free(col_name);
-  }
-  if (question_col == -1 || answer_col == -1) {
-    fprintf(stderr, "ERROR: no column named question or answer found\n");
-    fclose(questions);
+// Weighted picks per question before giving up on finding distinct ones.
+#define PICK_ATTEMPTS 64
+
+static int add_source(source_t ***sources, int *num_sources,
+                      source_t *source) {
+  source_t **new_sources =
+      realloc(*sources, (*num_sources + 1) * sizeof(**sources));
+  if (new_sources == NULL) {
+    fprintf(stderr, "ERROR: could not allocate sources\n");
+    source_release(source);
+    return 0;
+  }
+  *sources = new_sources;
+  new_sources[(*num_sources)++] = source;
+  return 1;
+}
+
+// Gets all files to read from the cache. Files that cannot be read are
+// skipped.
+static int collect_sources(config_t *config, source_t ***sources,
+                           int *num_sources) {
+  *sources = NULL;
+  *num_sources = 0;
+  for (const char *p = config->files; *p;) {
+    const char *sep = strchr(p, ':');
+    size_t len = (sep == NULL) ? strlen(p) : (size_t)(sep - p);
+    char *path = d0_strndup(p, len);
+    if (path == NULL) {
+      return 0;
+    }
+    p += len + (sep != NULL);
+    source_t *source =
+        (*path == 0) ? NULL : source_acquire(path, config->threads);
+    free(path);
+    if (source == NULL) {
+      continue;
+    }
+    if (!source->is_dir) {
+      if (!add_source(sources, num_sources, source)) {
+        return 0;
+      }
+      continue;
+    }
+    for (int i = 0; i < source->num_names; ++i) {
+      source_t *file = source_acquire(source->names[i], config->threads);
+      if (file != NULL && !add_source(sources, num_sources, file)) {
+        source_release(source);
+        return 0;
+      }
+    }
+    source_release(source);
+  }
+  return 1;
+}
+
+static void release_sources(source_t **sources, int num_sources) {
+  for (int i = 0; i < num_sources; ++i) {
+    source_release(sources[i]);
+  }
+  free(sources);
+}
+
+static int num_groups(const source_t *source) {
+  return source->is_bank ? (int)source->bank.header->num_groups
+                         : source->num_groups;
+}
+
+static const char *group_match(const source_t *source, int group) {
+  if (source->is_bank) {
+    return bank_string(&source->bank, source->bank.groups[group].match);
+  }
+  return source->groups[group].match;
+}
+
+static int group_size(const source_t *source, int group) {
+  if (source->is_bank) {
+    return source->bank.groups[group].num_rows;
+  }
+  return source->groups[group].num_rows;
+}
+
+static int is_weighted(const source_t *source) {
+  return source->is_bank ? source->bank.alias != NULL : source->weighted;
+}
+
+// Returns the total weight of the rows of a group.
+static double group_weight(const source_t *source, int group) {
+  if (!is_weighted(source)) {
+    return group_size(source, group);
+  }
+  double weight = source->is_bank ? source->bank.group_weights[group]
+                                  : source->groups[group].weight;
+  // Do not trust banks.
+  return (weight >= 0 && weight <= DBL_MAX) ? weight : 0;
+}
+
+// Picks a row of a group with probability proportional to its weight.
+static int pick_in_group(const source_t *source, int group, random_t *rng) {
+  int size = group_size(source, group);
+  if (!is_weighted(source)) {
+    return randint(rng, size);
+  }
+  if (source->is_bank) {
+    return alias_pick(source->bank.alias +
+                          source->bank.groups[group].first_row,
+                      size, rng);
+  }
+  return alias_pick(source->alias + source->groups[group].first_row, size,
+                    rng);
+}
+
+static int get_row(const source_t *source, int group, int index,
+                   const char **question, const char **answer) {
+  if (source->is_bank) {
+    const bank_t *bank = &source->bank;
+    const bank_row *row = &bank->rows[bank->groups[group].first_row + index];
+    *question = bank_string(bank, row->question);
+    *answer = bank_string(bank, row->answer);
+    return *question != NULL && *answer != NULL;
+  }
+  const source_row_t *row =
+      &source->rows[source->groups[group].first_row + index];
+  *question = row->question;
+  *answer = row->answer;
+  return 1;
+}
+
+// Marks the matching groups of a source, running the matcher once per
+// distinct match value. Uses matcher if there is no DFA.
+static void match_source(const config_t *config, const regex_t *matcher,
+                         const source_t *source, char *matching) {
+  for (int g = 0; g < num_groups(source); ++g) {
+    const char *match = group_match(source, g);
+    if (match == NULL) {
+      continue;
+    }
+    matching[g] = (config->dfa != NULL)
+                      ? dfa_match(config->dfa, match)
+                      : regexec(matcher, match, 0, NULL, 0) == 0;
+  }
+}
+
+static void free_matching(char **matching, int num_sources) {
+  for (int i = 0; i < num_sources; ++i) {
+    free(matching[i]);
+  }
+  free(matching);
+}
+
+// Marks the matching groups of all sources. This runs on every login, so
+// unlike loading it stays on the calling thread.
+static char **match_groups(config_t *config, source_t **sources,
+                           int num_sources) {
+  char **matching = calloc(num_sources + 1, sizeof(*matching));
+  if (matching == NULL) {
+    fprintf(stderr, "ERROR: could not allocate matches\n");
     return NULL;
   }
+  unsigned turn =
+      __atomic_fetch_add(&config->next_matcher, 1, __ATOMIC_RELAXED);
+  const regex_t *matcher = &config->matchers[turn % config->num_matchers];
+  for (int i = 0; i < num_sources; ++i) {
+    matching[i] = calloc(num_groups(sources[i]) + 1, 1);
+    if (matching[i] == NULL) {
+      fprintf(stderr, "ERROR: could not allocate matches\n");
+      free_matching(matching, num_sources);
+      return NULL;
+    }
+    match_source(config, matcher, sources[i], matching[i]);
+  }
+  return matching;
+}
+
+// Finds the source and group of the index-th matching row, and its index
+// within the group.
+static void find_row(source_t **sources, char **matching, int *index,
+                     int *source, int *group) {
+  for (int i = 0;; ++i) {
+    for (int g = 0; g < num_groups(sources[i]); ++g) {
+      if (!matching[i][g]) {
+        continue;
+      }
+      if (*index < group_size(sources[i], g)) {
+        *source = i;
+        *group = g;
+        return;
+      }
+      *index -= group_size(sources[i], g);
+    }
+  }
+}
+
+// Picks up to n distinct matching rows uniformly at random, in random order.
+// Returns the number of rows picked.
+static int pick_rows(source_t **sources, int num_sources, char **matching,
+                     int n, random_t *rng, const char **questions,
+                     const char **answers) {
+  long total = 0;
+  for (int i = 0; i < num_sources; ++i) {
+    for (int g = 0; g < num_groups(sources[i]); ++g) {
+      if (matching[i][g]) {
+        total += group_size(sources[i], g);
+      }
+    }
+  }
+  // Rows beyond this can never be picked.
+  int count = (total > INT_MAX) ? INT_MAX : total;
+  int held = (count < n) ? count : n;
+  int *picks = malloc((held + 1) * sizeof(int));
+  if (picks == NULL) {
+    fprintf(stderr, "ERROR: could not allocate picks\n");
+    return 0;
+  }
 
-  // Pick a question at random.
-  int index = 0;
-  char *accepted_question = NULL;
-  char *accepted_answer = NULL;
-  int line = 1;
-  while (fgets(buf, sizeof(buf), questions)) {
-    ++line;
-    char *match = NULL;
-    char *question = NULL;
-    char *answer = NULL;
-    csv_start(buf, &csvbuf);
-    for (int col = 0;; ++col) {
-      char *value = csv_read(&csvbuf);
-      if (value == NULL) {
+  // Pick distinct indices among the matching rows (Floyd's algorithm), then
+  // shuffle them, as Floyd's algorithm does not yield a random order.
+  for (int j = count - held; j < count; ++j) {
+    int pick = randint(rng, j + 1);
+    for (int k = 0; k < j - (count - held); ++k) {
+      if (picks[k] == pick) {
+        pick = j;
         break;
-      } else if (col == match_col) {
-        match = value;
-      } else if (col == question_col) {
-        question = value;
-      } else if (col == answer_col) {
-        answer = value;
-      } else {
-        free(value);
       }
     }
-    if (question == NULL || answer == NULL) {
-      fprintf(stderr,
-              "WARNING: no question or answer in line found in line %d\n",
-              line);
-      free(answer);
-      free(question);
-      free(match);
-      continue;
+    picks[j - (count - held)] = pick;
+  }
+  for (int k = held - 1; k > 0; --k) {
+    int other = randint(rng, k + 1);
+    int pick = picks[k];
+    picks[k] = picks[other];
+    picks[other] = pick;
+  }
+
+  int picked = 0;
+  for (int k = 0; k < held; ++k) {
+    int index = picks[k];
+    int i, g;
+    find_row(sources, matching, &index, &i, &g);
+    if (get_row(sources[i], g, index, &questions[picked], &answers[picked])) {
+      ++picked;
     }
-    if (regexec(&config->matcher, match ? match : "", 0, NULL, 0) != 0) {
-      free(answer);
-      free(question);
-      free(match);
-      continue;
+  }
+  free(picks);
+  return picked;
+}
+
+// Picks up to n distinct matching rows with probability proportional to their
+// weights: first a group by an alias table over all matching groups, then a
+// row within it. Returns the number of rows picked.
+static int pick_weighted_rows(source_t **sources, int num_sources,
+                              char **matching, int n, random_t *rng,
+                              const char **questions, const char **answers) {
+  int num_entries = 0;
+  for (int i = 0; i < num_sources; ++i) {
+    for (int g = 0; g < num_groups(sources[i]); ++g) {
+      num_entries += matching[i][g] != 0;
     }
-    free(match);
-    ++index;
-    if (randint(index) == 0) {
-      free(accepted_answer);
-      free(accepted_question);
-      accepted_question = question;
-      accepted_answer = answer;
-    } else {
-      free(answer);
-      free(question);
+  }
+  int *entry_sources = malloc((num_entries + 1) * sizeof(int));
+  int *entry_groups = malloc((num_entries + 1) * sizeof(int));
+  double *weights = malloc((num_entries + 1) * sizeof(double));
+  alias_t *table = malloc((num_entries + 1) * sizeof(alias_t));
+  int *picks = malloc(3 * n * sizeof(int));
+  int picked = 0;
+  if (entry_sources == NULL || entry_groups == NULL || weights == NULL ||
+      table == NULL || picks == NULL) {
+    fprintf(stderr, "ERROR: could not allocate picks\n");
+    goto done;
+  }
+  double total = 0;
+  int e = 0;
+  for (int i = 0; i < num_sources; ++i) {
+    for (int g = 0; g < num_groups(sources[i]); ++g) {
+      if (matching[i][g]) {
+        entry_sources[e] = i;
+        entry_groups[e] = g;
+        weights[e] = group_weight(sources[i], g);
+        total += weights[e++];
+      }
+    }
+  }
+  if (!(total > 0) || !alias_build(weights, num_entries, table)) {
+    goto done;
+  }
+
+  // Reject repeats. Give up eventually, as there may be fewer than n rows
+  // with a nonzero weight.
+  for (int attempts = 0; picked < n && attempts < PICK_ATTEMPTS * n;
+       ++attempts) {
+    e = alias_pick(table, num_entries, rng);
+    int i = entry_sources[e], g = entry_groups[e];
+    int index = pick_in_group(sources[i], g, rng);
+    int repeated = 0;
+    for (int k = 0; k < picked; ++k) {
+      if (picks[3 * k] == i && picks[3 * k + 1] == g &&
+          picks[3 * k + 2] == index) {
+        repeated = 1;
+        break;
+      }
+    }
+    if (repeated ||
+        !get_row(sources[i], g, index, &questions[picked], &answers[picked])) {
+      continue;
     }
+    picks[3 * picked] = i;
+    picks[3 * picked + 1] = g;
+    picks[3 * picked + 2] = index;
+    ++picked;
   }
 
-  fclose(questions);
+done:
+  free(picks);
+  free(table);
+  free(weights);
+  free(entry_groups);
+  free(entry_sources);
+  return picked;
+}
 
-  if (accepted_answer == NULL) {
+// Picks n questions at random, or fewer if not enough match. Their text
+// points into the returned sources, which must be released afterwards.
+// Returns the number of questions picked, or 0 on failure.
+static int pick_questions(config_t *config, random_t *rng, int n,
+                          const char **questions, const char **answers,
+                          source_t ***sources, int *num_sources) {
+  if (!collect_sources(config, sources, num_sources)) {
+    release_sources(*sources, *num_sources);
+    return 0;
+  }
+  char **matching = match_groups(config, *sources, *num_sources);
+  if (matching == NULL) {
+    fprintf(stderr, "ERROR: could not allocate questions\n");
+    release_sources(*sources, *num_sources);
+    return 0;
+  }
+  int weighted = 0;
+  for (int i = 0; i < *num_sources; ++i) {
+    weighted |= is_weighted((*sources)[i]);
+  }
+  int picked = weighted ? pick_weighted_rows(*sources, *num_sources, matching,
+                                             n, rng, questions, answers)
+                        : pick_rows(*sources, *num_sources, matching, n, rng,
+                                    questions, answers);
+  free_matching(matching, *num_sources);
+  if (picked == 0) {
     fprintf(stderr, "ERROR: could not find a single question\n");
-    free(accepted_question);
-    return NULL;
+    release_sources(*sources, *num_sources);
   }
+  return picked;
+}
 
-  *answer_state = malloc(sizeof(answer_state_t));
-  if (*answer_state == NULL) {
-    fprintf(stderr, "ERROR: could not allocate answer_state\n");
+int make_questions(config_t *config, random_t *rng, arena_t *arena, int n,
+                   char **questions, answer_state_t **answer_states) {
+  if (n <= 0) {
+    return 1;
+  }
+
+  // Pick n distinct questions at random.
+  const char **accepted_questions = arena_alloc(arena, n * sizeof(char *));
+  const char **accepted_answers = arena_alloc(arena, n * sizeof(char *));
+  if (accepted_questions == NULL || accepted_answers == NULL) {
+    fprintf(stderr, "ERROR: could not allocate questions\n");
+    return 0;
+  }
+  source_t **sources;
+  int num_sources;
+  int accepted = pick_questions(config, rng, n, accepted_questions,
+                                accepted_answers, &sources, &num_sources);
+  if (accepted == 0) {
+    return 0;
+  }
+
+  int ok = 1;
+  for (int i = 0; i < n && ok; ++i) {
+    // Fewer matching questions than asked for: repeat some.
+    int src = (i < accepted) ? i : randint(rng, accepted);
+    answer_states[i] = arena_alloc(arena, sizeof(answer_state_t));
+    if (answer_states[i] == NULL) {
+      fprintf(stderr, "ERROR: could not allocate answer_state\n");
+      ok = 0;
+      break;
+    }
+    answer_states[i]->answer = arena_strndup(arena, accepted_answers[src],
+                                             strlen(accepted_answers[src]));
+    answer_states[i]->ignore_case = config->ignore_case;
+    questions[i] = arena_asprintf(arena, "%s ", accepted_questions[src]);
+    if (answer_states[i]->answer == NULL || questions[i] == NULL) {
+      ok = 0;
+    }
+  }
+
+  release_sources(sources, num_sources);
+  return ok;
+}
+
+// Copies a string formatted as "<s><suffix>" to *buf, or returns NULL if it
+// does not fit.
+static char *put(char **buf, size_t *size, const char *s, const char *suffix) {
+  int len = snprintf(*buf, *size, "%s%s", s, suffix);
+  if (len < 0 || (size_t)len >= *size) {
     return NULL;
   }
-  (*answer_state)->answer = accepted_answer;
-  (*answer_state)->ignore_case = config->ignore_case;
+  char *out = *buf;
+  *buf += len + 1;
+  *size -= len + 1;
+  return out;
+}
 
-  char *formatted_question = d0_asprintf("%s ", accepted_question);
-  free(accepted_question);
-  return formatted_question;
+int make_question_records(config_t *config, random_t *rng,
+                          random_lanes_t *lanes __attribute__((unused)), int n,
+                          question_record_t *records, char *buf,
+                          size_t size) {
+  if (n <= 0) {
+    return 0;
+  }
+  const char **accepted_questions = malloc(n * sizeof(char *));
+  const char **accepted_answers = malloc(n * sizeof(char *));
+  if (accepted_questions == NULL || accepted_answers == NULL) {
+    fprintf(stderr, "ERROR: could not allocate questions\n");
+    free(accepted_answers);
+    free(accepted_questions);
+    return 0;
+  }
+  source_t **sources;
+  int num_sources;
+  int accepted = pick_questions(config, rng, n, accepted_questions,
+                                accepted_answers, &sources, &num_sources);
+  int made = 0;
+  if (accepted > 0) {
+    for (; made < n; ++made) {
+      // Fewer matching questions than asked for: repeat some.
+      int src = (made < accepted) ? made : randint(rng, accepted);
+      records[made].question = put(&buf, &size, accepted_questions[src], " ");
+      records[made].answer = put(&buf, &size, accepted_answers[src], "");
+      if (records[made].question == NULL || records[made].answer == NULL) {
+        break;
+      }
+    }
+    release_sources(sources, num_sources);
+  }
+  free(accepted_answers);
+  free(accepted_questions);
+  return made;
 }
 
 int check_answer(answer_state_t *answer_state, const char *given) {
@@ -233,14 +649,11 @@ int check_answer(answer_state_t *answer_state, const char *given) {
   return !strcmp(given, answer_state->answer);
 }
 
-char *get_answer(answer_state_t *answer_state) {
-  return d0_strndup(answer_state->answer, strlen(answer_state->answer));
+const char *get_answer(answer_state_t *answer_state) {
+  return answer_state->answer;
 }
 
-void free_answer(answer_state_t *answer_state) {
-  if (answer_state == NULL) {
-    return;
-  }
-  free(answer_state->answer);
-  free(answer_state);
+int answer_kind(answer_state_t *answer_state __attribute__((unused))) {
+  return 0;
 }
+
@@ -0,0 +1,82 @@
+// Writes a synthetic questions CSV file of a given size, for benchmarking
+// pam_questions_file on large banks. The output only depends on the options.
+
+#include <stdio.h>  // for printf, snprintf, fprintf, putchar, stderr
+#include <stdlib.h> // for atoi, atol, strtod
+#include <string.h> // for strcmp
+
+typedef struct {
+  long rows;
+  long matches;       // Number of distinct match values.
+  double quoted;      // Share of questions quoted with embedded "".
+  int line_length;    // Approximate length of each line.
+  int extra_columns;  // Columns other than question, answer and match.
+} options_t;
+
+// Writes c n times.
+static void repeat(char c, int n) {
+  for (int i = 0; i < n; ++i) {
+    putchar(c);
+  }
+}
+
+static void write_row(const options_t *options, long row) {
+  // Spread the quoted rows evenly, by the fractional part of row * quoted.
+  int quoted = (long)((row + 1) * options->quoted) !=
+               (long)(row * options->quoted);
+  char answer[32], match[32];
+  int len = snprintf(answer, sizeof(answer), "answer %ld", row);
+  len += snprintf(match, sizeof(match), "m%ld", row % options->matches);
+  // ,,\n plus the extra columns and the question text below.
+  len += 3 + 2 * options->extra_columns;
+  if (quoted) {
+    len += printf("\"Say \"\"%ld\"\" ", row);
+  } else {
+    len += printf("Say %ld ", row);
+  }
+  repeat('x', options->line_length - len - 1 - quoted);
+  printf("?%s,%s,%s", quoted ? "\"" : "", answer, match);
+  for (int i = 0; i < options->extra_columns; ++i) {
+    printf(",%c", 'a' + i % 26);
+  }
+  putchar('\n');
+}
+
+int main(int argc, char **argv) {
+  options_t options = {1000, 100, 0.1, 64, 0};
+  for (int i = 1; i < argc; i += 2) {
+    if (i + 1 >= argc) {
+      options.rows = 0;
+    } else if (!strcmp(argv[i], "-r")) {
+      options.rows = atol(argv[i + 1]);
+    } else if (!strcmp(argv[i], "-m")) {
+      options.matches = atol(argv[i + 1]);
+    } else if (!strcmp(argv[i], "-q")) {
+      options.quoted = strtod(argv[i + 1], NULL);
+    } else if (!strcmp(argv[i], "-l")) {
+      options.line_length = atoi(argv[i + 1]);
+    } else if (!strcmp(argv[i], "-c")) {
+      options.extra_columns = atoi(argv[i + 1]);
+    } else {
+      options.rows = 0;
+    }
+  }
+  if (options.rows <= 0 || options.matches <= 0 || options.quoted < 0 ||
+      options.quoted > 1 || options.extra_columns < 0) {
+    fprintf(stderr,
+            "Usage: %s [-r rows] [-m distinct match values] "
+            "[-q share of quoted questions] [-l line length] "
+            "[-c extra columns] > questions.csv\n",
+            argv[0]);
+    return 1;
+  }
+  printf("question,answer,match");
+  for (int i = 0; i < options.extra_columns; ++i) {
+    printf(",extra%d", i + 1);
+  }
+  putchar('\n');
+  for (long row = 0; row < options.rows; ++row) {
+    write_row(&options, row);
+  }
+  return 0;
+}
@@ -3,45 +3,76 @@
 #include "helpers.h"
 
 #include <limits.h> // for INT_MAX
-#include <stdarg.h> // for va_end, va_start, va_list
-#include <stdint.h> // for uint32_t
-#include <stdio.h>  // for fprintf, stderr, vsnprintf
+#include <stdarg.h> // for va_end, va_start, va_copy, va_list
+#include <stdint.h> // for uint32_t, uint64_t, uintptr_t
+#include <stdio.h>  // for fprintf, perror, stderr, vsnprintf
 #include <stdlib.h> // for malloc, free
-#include <string.h> // for memcpy, strlen
+#include <string.h> // for memchr, memcpy, strlen
 #include <time.h>   // for time, clock_gettime
 
 #ifdef __linux__
 #include <sys/random.h> // for getrandom
 #endif
 
-char *d0_asprintf(const char *restrict fmt, ...) {
-  va_list ap;
-  va_start(ap, fmt);
-  char tiny[1];
-  int n = vsnprintf(tiny, sizeof(tiny), fmt, ap);
-  va_end(ap);
+// Formatted strings up to this size are formatted only once.
+#define FORMAT_FAST_MAX 256
+
+char *d0_vformat(const char *restrict fmt, va_list ap,
+                 void *(*alloc)(void *ctx, size_t size),
+                 void (*release)(void *ctx, void *p), void *ctx) {
+  va_list again;
+  va_copy(again, ap);
+  char fast[FORMAT_FAST_MAX];
+  int n = vsnprintf(fast, sizeof(fast), fmt, ap);
   if (n < 0 || n >= INT_MAX) {
     fprintf(stderr, "ERROR: vsnprintf unexpectedly returned %d\n", n);
+    va_end(again);
     return NULL;
   }
-  char *buf = malloc(n + 1);
+  char *buf = alloc(ctx, (size_t)n + 1);
   if (buf == NULL) {
-    fprintf(stderr, "ERROR: could not allocate %d bytes\n", n + 1);
+    va_end(again);
     return NULL;
   }
-  va_start(ap, fmt);
-  int m = vsnprintf(buf, n + 1, fmt, ap);
-  va_end(ap);
+  if (n < (int)sizeof(fast)) {
+    memcpy(buf, fast, n + 1);
+    va_end(again);
+    return buf;
+  }
+  int m = vsnprintf(buf, (size_t)n + 1, fmt, again);
+  va_end(again);
   if (m != n) {
     fprintf(stderr,
             "ERROR: vsnprintf non-deterministic: returned %d, then %d\n", n, m);
-    free(buf);
+    if (release != NULL) {
+      release(ctx, buf);
+    }
     return NULL;
   }
   buf[n] = 0;
   return buf;
 }
 
+static void *format_malloc(void *ctx __attribute__((unused)), size_t size) {
+  void *p = malloc(size);
+  if (p == NULL) {
+    fprintf(stderr, "ERROR: could not allocate %d bytes\n", (int)size);
+  }
+  return p;
+}
+
+static void format_free(void *ctx __attribute__((unused)), void *p) {
+  free(p);
+}
+
+char *d0_asprintf(const char *restrict fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  char *buf = d0_vformat(fmt, ap, format_malloc, format_free, NULL);
+  va_end(ap);
+  return buf;
+}
+
 void d0_strlcpy(char *dst, const char *src, size_t dst_size) {
   if (dst_size == 0) {
     return;
@@ -64,41 +95,165 @@ char *d0_strndup(const char *s, size_t n) {
     fprintf(stderr, "ERROR: could not allocate %d bytes\n", (int)(n + 1));
     return NULL;
   }
-  d0_strlcpy(out, s, size);
+  const char *nul = memchr(s, 0, n);
+  size_t len = (nul == NULL) ? n : (size_t)(nul - s);
+  memcpy(out, s, len);
+  out[len] = 0;
   return out;
 }
 
-static int want_init_random = 1;
-uint32_t random_seed;
-uint32_t random_buf;
+uint64_t hash_bytes(const char *s, size_t len) {
+  uint64_t h = 14695981039346656037ULL;
+  for (size_t i = 0; i < len; ++i) {
+    h = (h ^ (unsigned char)s[i]) * 1099511628211ULL;
+  }
+  return h;
+}
+
+static uint64_t splitmix64(uint64_t *x) {
+  uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
 
-void maybe_init_random() {
-  int do_init_random = want_init_random;
-  want_init_random = 1;
-  if (do_init_random) {
+void random_init(random_t *stream) {
 #ifdef __linux__
-    if (getrandom(&random_seed, sizeof(random_seed), 0) ==
-        sizeof(random_seed)) {
-      goto got_seed;
-    }
-    perror("getrandom");
+  if (getrandom(stream->s, sizeof(stream->s), 0) == sizeof(stream->s)) {
+    goto got_seed;
+  }
+  perror("getrandom");
 #endif
-    random_seed = (uint32_t)time(NULL);
-    struct timespec ts;
-    if (!clock_gettime(CLOCK_REALTIME, &ts)) {
-      random_seed ^= ts.tv_nsec;
+  uint64_t x = (uint64_t)time(NULL);
+  struct timespec ts;
+  if (!clock_gettime(CLOCK_REALTIME, &ts)) {
+    x = x * 1000000000 + ts.tv_nsec;
+  }
+  // Tell apart streams seeded in the same nanosecond.
+  x ^= (uint64_t)(uintptr_t)stream;
+  for (int i = 0; i < 4; ++i) {
+    stream->s[i] = splitmix64(&x);
+  }
+got_seed:
+  // The all-zero state is the one state xoshiro never leaves.
+  if ((stream->s[0] | stream->s[1] | stream->s[2] | stream->s[3]) == 0) {
+    stream->s[0] = 1;
+  }
+}
+
+static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+
+// This is xoshiro256** by David Blackman and Sebastiano Vigna.
+uint64_t random_next(random_t *stream) {
+  uint64_t *s = stream->s;
+  uint64_t result = rotl(s[1] * 5, 7) * 9;
+  uint64_t t = s[1] << 17;
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = rotl(s[3], 45);
+  return result;
+}
+
+void random_fork(random_t *parent, random_t *stream) {
+  // Hand out the current stream and jump the parent ahead by 2^128 steps,
+  // so that no two streams ever overlap.
+  static const uint64_t jump[4] = {
+      0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL, 0xa9582618e03fc9aaULL,
+      0x39abdc4529b1661cULL};
+  *stream = *parent;
+  uint64_t s[4] = {0, 0, 0, 0};
+  for (int i = 0; i < 4; ++i) {
+    for (int b = 0; b < 64; ++b) {
+      if (jump[i] & (1ULL << b)) {
+        for (int j = 0; j < 4; ++j) {
+          s[j] ^= parent->s[j];
+        }
+      }
+      random_next(parent);
     }
-  got_seed:;
   }
-  random_buf = random_seed;
+  for (int j = 0; j < 4; ++j) {
+    parent->s[j] = s[j];
+  }
 }
 
-void skip_next_init_random() { want_init_random = 0; }
+int randint(random_t *stream, int n) {
+  // Lemire's nearly divisionless method: scale a 32 bit number to [0, n) by
+  // multiplication, and only divide to reject the few biased results.
+  uint32_t bound = (uint32_t)n;
+  uint64_t m = (random_next(stream) >> 32) * bound;
+  if ((uint32_t)m < bound) {
+    uint32_t threshold = -bound % bound;
+    while ((uint32_t)m < threshold) {
+      m = (random_next(stream) >> 32) * bound;
+    }
+  }
+  return (int)(m >> 32);
+}
+
+uint64_t randint64(random_t *stream, uint64_t n) {
+  // Reject the incomplete copy of [0, n) at the bottom so that the remainder
+  // is unbiased.
+  uint64_t threshold = -n % n;
+  uint64_t x;
+  do {
+    x = random_next(stream);
+  } while (x < threshold);
+  return x % n;
+}
+
+void random_lanes_fork(random_t *parent, random_lanes_t *lanes) {
+  for (int l = 0; l < RANDOM_LANES; ++l) {
+    random_t stream;
+    random_fork(parent, &stream);
+    for (int i = 0; i < 4; ++i) {
+      lanes->s[i][l] = stream.s[i];
+    }
+  }
+}
+
+void random_lanes_next(random_lanes_t *lanes, uint64_t out[RANDOM_LANES]) {
+  uint64_t *s0 = lanes->s[0], *s1 = lanes->s[1], *s2 = lanes->s[2],
+           *s3 = lanes->s[3];
+  for (int l = 0; l < RANDOM_LANES; ++l) {
+    out[l] = rotl(s1[l] * 5, 7) * 9;
+    uint64_t t = s1[l] << 17;
+    s2[l] ^= s0[l];
+    s3[l] ^= s1[l];
+    s1[l] ^= s2[l];
+    s0[l] ^= s3[l];
+    s2[l] ^= t;
+    s3[l] = rotl(s3[l], 45);
+  }
+}
+
+void randint_lanes(random_lanes_t *lanes, const uint32_t bounds[RANDOM_LANES],
+                   int out[RANDOM_LANES]) {
+  uint64_t x[RANDOM_LANES], m[RANDOM_LANES];
+  random_lanes_next(lanes, x);
+  int reject = 0;
+  for (int l = 0; l < RANDOM_LANES; ++l) {
+    m[l] = (x[l] >> 32) * bounds[l];
+    reject |= (uint32_t)m[l] < bounds[l];
+  }
+  if (reject) {
+    // Rarely, some lane needs the rejection step of randint.
+    for (int l = 0; l < RANDOM_LANES; ++l) {
+      uint32_t threshold = -bounds[l] % bounds[l];
+      while ((uint32_t)m[l] < threshold) {
+        random_lanes_next(lanes, x);
+        m[l] = (x[l] >> 32) * bounds[l];
+      }
+    }
+  }
+  for (int l = 0; l < RANDOM_LANES; ++l) {
+    out[l] = (int)(m[l] >> 32);
+  }
+}
 
-int randint(int n) {
-  // This is POSIX.1-2001's PRNG.
-  // Better PRNG welcome.
-  random_buf = random_buf * 1103515245 + 12345;
-  int r = (random_buf / 65536) % 32768;
-  return r % n;
+double randuniform(random_t *stream) {
+  return (random_next(stream) >> 11) * 0x1.0p-53;
 }
@@ -1,14 +1,54 @@
 #ifndef HELPERS_H
 #define HELPERS_H
 
+#include <stdarg.h> // for va_list
 #include <stddef.h> // for size_t
+#include <stdint.h> // for uint32_t, uint64_t
 
 char *d0_asprintf(const char *restrict fmt, ...);
+// Formats like vsnprintf into memory from alloc, which reports its own
+// failures. Returns NULL on failure, after passing the memory to release if
+// not NULL.
+char *d0_vformat(const char *restrict fmt, va_list ap,
+                 void *(*alloc)(void *ctx, size_t size),
+                 void (*release)(void *ctx, void *p), void *ctx);
 void d0_strlcpy(char *dst, const char *src, size_t dst_size);
 char *d0_strndup(const char *s, size_t n);
 
-void maybe_init_random(void);
-void skip_next_init_random(void);
-int randint(int n);
+// Hashes a string for hash tables (FNV-1a).
+uint64_t hash_bytes(const char *s, size_t len);
+
+// State of a xoshiro256** random number generator.
+typedef struct {
+  uint64_t s[4];
+} random_t;
+
+// Seeds a stream from the system's random source.
+void random_init(random_t *stream);
+uint64_t random_next(random_t *stream);
+// Returns a random number in [0, n), without bias; n must be positive.
+int randint(random_t *stream, int n);
+// Returns a random number in [0, n), without bias; n must be positive.
+uint64_t randint64(random_t *stream, uint64_t n);
+// Returns a random number in [0, 1).
+double randuniform(random_t *stream);
+
+// Streams stored lane by lane, so that compilers can advance all of them at
+// once using vector instructions.
+#define RANDOM_LANES 4
+typedef struct {
+  uint64_t s[4][RANDOM_LANES];
+} random_lanes_t;
+
+// Forks RANDOM_LANES streams from parent.
+void random_lanes_fork(random_t *parent, random_lanes_t *lanes);
+void random_lanes_next(random_lanes_t *lanes, uint64_t out[RANDOM_LANES]);
+// Like randint, for every lane with its own bound.
+void randint_lanes(random_lanes_t *lanes, const uint32_t bounds[RANDOM_LANES],
+                   int out[RANDOM_LANES]);
+
+// Seeds a separate stream of random numbers from another one, e.g. for use by
+// another thread. Streams do not overlap for the first 2^128 numbers.
+void random_fork(random_t *parent, random_t *stream);
 
 #endif
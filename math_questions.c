@@ -1,14 +1,17 @@
 #include "questions.h" // for config_t, answer_state_t, build_config, check...
 
-#include <ctype.h>    // for isspace
+#include <ctype.h>    // for isdigit, isspace
 #include <langinfo.h> // for nl_langinfo, CODESET
 #include <limits.h>   // for INT_MAX, INT_MIN
 #include <math.h>     // for sqrt
-#include <stdio.h>    // for fprintf, stderr, sscanf, NULL, size_t
-#include <stdlib.h>   // for abs, free, malloc
-#include <string.h>   // for strcmp, strncmp, strlen
+#include <stdint.h>   // for uint32_t
+#include <stdio.h>    // for fprintf, snprintf, stderr, sscanf, NULL, size_t
+#include <stdlib.h>   // for abs, free, malloc, strtol
+#include <string.h>   // for strchr, strcmp, strncmp, strlen
 
-#include "helpers.h" // for d0_asprintf
+#include "arena.h"   // for arena_alloc, arena_strndup, arena_t
+#include "helpers.h" // for randint, randint64, random_t, random_lanes_t, ...
+#include "options.h" // for for_each_option
 
 enum {
   ADD,
@@ -23,20 +26,44 @@ enum {
   NUM_OPS
 };
 
+// Characters of the ops in the ops= option, in the order of the enum.
+static const char op_chars[] = "+-*/mrdqc";
+
+// Ops can be weighted up to this.
+#define OP_WEIGHT_MAX 100
+
+// Distinct prime factors an int can have.
+#define PRIMES_MAX 9
+
 struct config_s {
   int questions; // Used by pam_math.c.
   int attempts;  // Used by pam_math.c.
+  int batch;     // Ask all questions in one conv call.
+  int stats;     // Log per-phase timings to syslog.
+  char *counters; // Path of the counters file, or NULL.
   int amin;
   int amax;
   int mmin;
   int mmax;
-  int ops;
+  int op_weights[NUM_OPS];
+
+  // Every op as often as its weight, to pick one in constant time.
+  unsigned char op_table[NUM_OPS * OP_WEIGHT_MAX];
+  int op_table_size;
+  // For CANCEL: per divisor_at index, the number of coprime pairs with a
+  // smaller index as denominator, and the total at the end.
+  long long *coprime_counts;
 
   int use_utf8; // Set from the locale.
 };
 
+const char module_name[] = "pam_math";
+
 int num_questions(config_t *config) { return config->questions; }
 int num_attempts(config_t *config) { return config->attempts; }
+int batch_prompts(config_t *config) { return config->batch; }
+int collect_stats(config_t *config) { return config->stats; }
+const char *counters_file(config_t *config) { return config->counters; }
 
 // a + b must fit for all a, b in range.
 #define AMIN_MIN (-(INT_MAX / 2))
@@ -51,17 +78,193 @@ int num_attempts(config_t *config) { return config->attempts; }
 #error positive integer range must be smaller or equal negative integer range
 #endif
 
-static int gcd(int a, int b) {
-  if (a < 0) {
-    return gcd(-a, b);
+// Nonzero values in mmin..mmax, to be used as divisors.
+static int num_divisors(const config_t *config) {
+  int n = config->mmax - config->mmin + 1;
+  return (config->mmin <= 0 && config->mmax >= 0) ? n - 1 : n;
+}
+
+// Maps [0, num_divisors) to the nonzero values in mmin..mmax, in order.
+static int divisor_at(const config_t *config, int i) {
+  int b = config->mmin + i;
+  return (config->mmin <= 0 && b >= 0) ? b + 1 : b;
+}
+
+static int random_divisor(const config_t *config, random_t *rng) {
+  return divisor_at(config, randint(rng, num_divisors(config)));
+}
+
+// Returns the number of distinct prime factors of n > 0, stored in primes.
+static int prime_factors(int n, int primes[PRIMES_MAX]) {
+  int num_primes = 0;
+  for (int p = 2; p <= n / p; ++p) {
+    if (n % p == 0) {
+      primes[num_primes++] = p;
+      while (n % p == 0) {
+        n /= p;
+      }
+    }
+  }
+  if (n > 1) {
+    primes[num_primes++] = n;
+  }
+  return num_primes;
+}
+
+static long long floor_div(long long x, long long d) {
+  return (x >= 0) ? x / d : -((-x + d - 1) / d);
+}
+
+// Counts the numbers in lo..hi with none of the given prime factors, by
+// inclusion-exclusion.
+static long long count_coprime(const int *primes, int num_primes, int lo,
+                               int hi) {
+  long long count = 0;
+  for (int subset = 0; subset < (1 << num_primes); ++subset) {
+    long long d = 1;
+    int sign = 1;
+    for (int i = 0; i < num_primes; ++i) {
+      if (subset & (1 << i)) {
+        d *= primes[i];
+        sign = -sign;
+      }
+    }
+    count += sign * (floor_div(hi, d) - floor_div(lo - 1, d));
   }
-  if (b < 0) {
-    return gcd(a, -b);
+  return count;
+}
+
+// Counts, for every divisor, the coprime pairs with an earlier divisor as
+// denominator, so that picking a pair needs no retries.
+static int build_coprime_counts(config_t *config) {
+  int n = num_divisors(config);
+  config->coprime_counts = malloc((n + 1) * sizeof(long long));
+  if (config->coprime_counts == NULL) {
+    fprintf(stderr, "ERROR: could not allocate coprime counts\n");
+    return 0;
   }
-  if (b == 0) {
-    return a;
+  long long total = 0;
+  for (int i = 0; i < n; ++i) {
+    config->coprime_counts[i] = total;
+    int primes[PRIMES_MAX];
+    int num_primes = prime_factors(abs(divisor_at(config, i)), primes);
+    total += count_coprime(primes, num_primes, config->mmin, config->mmax);
   }
-  return gcd(b, a % b);
+  config->coprime_counts[n] = total;
+  return 1;
+}
+
+// Picks a uniformly random pair a, b in mmin..mmax with b nonzero and
+// gcd(a, b) = 1.
+static void random_coprime_pair(const config_t *config, random_t *rng, int *a,
+                                int *b) {
+  const long long *counts = config->coprime_counts;
+  int n = num_divisors(config);
+  long long r = randint64(rng, counts[n]);
+  // The denominator is the last one with counts[i] <= r.
+  int lo = 0, hi = n - 1;
+  while (lo < hi) {
+    int mid = lo + (hi - lo + 1) / 2;
+    if (counts[mid] <= r) {
+      lo = mid;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  *b = divisor_at(config, lo);
+  r -= counts[lo];
+  // The numerator is the (r+1)-th one coprime to it.
+  int primes[PRIMES_MAX];
+  int num_primes = prime_factors(abs(*b), primes);
+  lo = config->mmin;
+  hi = config->mmax;
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if (count_coprime(primes, num_primes, config->mmin, mid) > r) {
+      hi = mid;
+    } else {
+      lo = mid + 1;
+    }
+  }
+  *a = lo;
+}
+
+static void apply_option(void *ctx, const char *field, const char *arg) {
+  config_t *config = ctx;
+  if (sscanf(field, "questions=%d", &config->questions) == 1) {
+    return;
+  }
+  if (sscanf(field, "attempts=%d", &config->attempts) == 1) {
+    return;
+  }
+  if (sscanf(field, "batch=%d", &config->batch) == 1) {
+    return;
+  }
+  if (sscanf(field, "stats=%d", &config->stats) == 1) {
+    return;
+  }
+  if (!strncmp(field, "counters=", 9)) {
+    free(config->counters);
+    config->counters = d0_strndup(field + 9, strlen(field + 9));
+    return;
+  }
+  if (sscanf(field, "amin=%d", &config->amin) == 1) {
+    return;
+  }
+  if (sscanf(field, "amax=%d", &config->amax) == 1) {
+    return;
+  }
+  if (sscanf(field, "mmin=%d", &config->mmin) == 1) {
+    return;
+  }
+  if (sscanf(field, "mmax=%d", &config->mmax) == 1) {
+    return;
+  }
+  if (!strncmp(field, "ops=", 4)) {
+    for (int op = 0; op < NUM_OPS; ++op) {
+      config->op_weights[op] = 0;
+    }
+    for (const char *p = field + 4; *p; ++p) {
+      const char *op_char = strchr(op_chars, *p);
+      if (op_char == NULL) {
+        fprintf(stderr, "Unexpected %.*sops= character in config: %c\n",
+                (int)(field - arg), arg, *p);
+        continue;
+      }
+      int *op_weight = &config->op_weights[op_char - op_chars];
+      // Without a weight, an operator is just enabled, so repeating it
+      // changes nothing; a weight following it replaces its weight.
+      if (!isdigit((unsigned char)p[1])) {
+        if (*op_weight == 0) {
+          *op_weight = 1;
+        }
+        continue;
+      }
+      char *end;
+      long weight = strtol(p + 1, &end, 10);
+      p = end - 1;
+      if (weight > OP_WEIGHT_MAX) {
+        fprintf(stderr, "Overly large %.*sops= weight for %c - shrinking.\n",
+                (int)(field - arg), arg, *op_char);
+        weight = OP_WEIGHT_MAX;
+      }
+      *op_weight = weight;
+    }
+    return;
+  }
+  if (!strcmp(field, "use_utf8=auto")) {
+    config->use_utf8 = -1;
+    return;
+  }
+  if (!strcmp(field, "use_utf8=yes")) {
+    config->use_utf8 = 1;
+    return;
+  }
+  if (!strcmp(field, "use_utf8=no")) {
+    config->use_utf8 = 0;
+    return;
+  }
+  fprintf(stderr, "Unexpected option in config: %s\n", arg);
 }
 
 config_t *build_config(const char *user, int argc, const char **argv) {
@@ -72,83 +275,19 @@ config_t *build_config(const char *user, int argc, const char **argv) {
   }
   config->questions = 3;
   config->attempts = 3;
+  config->batch = 0;
+  config->stats = 0;
+  config->counters = NULL;
   config->amin = 0;
   config->amax = 10;
   config->mmin = 2;
   config->mmax = 9;
-  config->ops = 0;
-  config->use_utf8 = -1;
-  size_t userlen = strlen(user);
-  for (int i = 0; i < argc; ++i) {
-    const char *arg = argv[i];
-    const char *field;
-    if (arg[0] == '.') {
-      field = arg + 1;
-    } else if (!strncmp(arg, user, userlen) && arg[userlen] == '.') {
-      field = arg + userlen + 1;
-    } else {
-      continue;
-    }
-    if (sscanf(field, "questions=%d", &config->questions) == 1) {
-      continue;
-    }
-    if (sscanf(field, "attempts=%d", &config->attempts) == 1) {
-      continue;
-    }
-    if (sscanf(field, "amin=%d", &config->amin) == 1) {
-      continue;
-    }
-    if (sscanf(field, "amax=%d", &config->amax) == 1) {
-      continue;
-    }
-    if (sscanf(field, "mmin=%d", &config->mmin) == 1) {
-      continue;
-    }
-    if (sscanf(field, "mmax=%d", &config->mmax) == 1) {
-      continue;
-    }
-    if (!strncmp(field, "ops=", 4)) {
-      config->ops = 0;
-      for (const char *p = field + 4; *p; ++p) {
-        if (*p == '+') {
-          config->ops |= (1 << ADD);
-        } else if (*p == '-') {
-          config->ops |= (1 << SUB);
-        } else if (*p == '*') {
-          config->ops |= (1 << MUL);
-        } else if (*p == '/') {
-          config->ops |= (1 << DIV);
-        } else if (*p == 'm') {
-          config->ops |= (1 << MOD);
-        } else if (*p == 'r') {
-          config->ops |= (1 << REM);
-        } else if (*p == 'd') {
-          config->ops |= (1 << DIV_WITH_MOD);
-        } else if (*p == 'q') {
-          config->ops |= (1 << QUOT_WITH_REM);
-        } else if (*p == 'c') {
-          config->ops |= (1 << CANCEL);
-        } else {
-          fprintf(stderr, "Unexpected %.*sops= character in config: %c\n",
-                  (int)(field - arg), arg, *p);
-        }
-      }
-      continue;
-    }
-    if (!strcmp(field, "use_utf8=auto")) {
-      config->use_utf8 = -1;
-      continue;
-    }
-    if (!strcmp(field, "use_utf8=yes")) {
-      config->use_utf8 = 1;
-      continue;
-    }
-    if (!strcmp(field, "use_utf8=no")) {
-      config->use_utf8 = 0;
-      continue;
-    }
-    fprintf(stderr, "Unexpected option in config: %s\n", arg);
+  for (int op = 0; op < NUM_OPS; ++op) {
+    config->op_weights[op] = 0;
   }
+  config->coprime_counts = NULL;
+  config->use_utf8 = -1;
+  for_each_option(user, argc, argv, apply_option, config);
 
   int fixed = 0;
 
@@ -263,216 +402,371 @@ config_t *build_config(const char *user, int argc, const char **argv) {
     config->use_utf8 = !strcmp(nl_langinfo(CODESET), "UTF-8");
   }
 
-  if (config->ops == 0) {
+  config->op_table_size = 0;
+  for (int op = 0; op < NUM_OPS; ++op) {
+    for (int i = 0; i < config->op_weights[op]; ++i) {
+      config->op_table[config->op_table_size++] = op;
+    }
+  }
+  if (config->op_table_size == 0) {
     config->questions = 0;
   }
 
+  if (config->op_weights[CANCEL] > 0 && !build_coprime_counts(config)) {
+    free_config(config);
+    return NULL;
+  }
+
   return config;
 }
 
-void free_config(config_t *config) { free(config); }
+void free_config(config_t *config) {
+  free(config->coprime_counts);
+  free(config->counters);
+  free(config);
+}
 
 struct answer_state_s {
+  // Numbers are compared as numbers, fractions as text without spaces.
+  int answer_is_num;
   int answer_num;
   char *answer_str;
+  int op;
 };
 
-char *make_question(config_t *config, answer_state_t **answer_state) {
+// A problem "a op b", whose answer is c, or c/c_den for CANCEL.
+typedef struct {
   int op;
+  int a, b;
+  int c, c_den;
+} problem_t;
+
+// Long enough for any question.
+#define QUESTION_MAX 128
 
-  do {
-    op = randint(NUM_OPS);
-  } while ((config->ops & (1 << op)) == 0);
+static int make_problem(const config_t *config, random_t *rng, int op,
+                        problem_t *problem) {
+  int a, b, c, q, r, s;
+  int c_den = 1;
+  switch (op) {
+  case ADD:
+    a = config->amin + randint(rng, config->amax - config->amin + 1);
+    b = config->amin + randint(rng, config->amax - config->amin + 1);
+    c = a + b;
+    break;
+  case SUB:
+    c = config->amin + randint(rng, config->amax - config->amin + 1);
+    b = config->amin + randint(rng, config->amax - config->amin + 1);
+    a = c + b;
+    break;
+  case MUL:
+    a = config->mmin + randint(rng, config->mmax - config->mmin + 1);
+    b = config->mmin + randint(rng, config->mmax - config->mmin + 1);
+    c = a * b;
+    break;
+  case DIV:
+    c = config->mmin + randint(rng, config->mmax - config->mmin + 1);
+    b = random_divisor(config, rng);
+    a = c * b;
+    break;
+  case MOD:
+    q = config->mmin + randint(rng, config->mmax - config->mmin + 1);
+    b = random_divisor(config, rng);
+    s = (b < 0 ? -1 : +1);
+    // mod result always agrees in sign with divisor.
+    c = s * randint(rng, abs(b));
+    a = q * b + c;
+    break;
+  case REM:
+    q = config->mmin + randint(rng, config->mmax - config->mmin + 1);
+    b = random_divisor(config, rng);
+    // rem result always agrees in sign with dividend.
+    // The dividend is not computed yet though, but only the result is!
+    s = (b < 0 ? -1 : +1);
+    s *= (q < 0 ? -1 : q > 0 ? +1 : randint(rng, 2) * 2 - 1);
+    c = s * randint(rng, abs(b));
+    a = q * b + c;
+    break;
+  case DIV_WITH_MOD:
+    c = config->mmin + randint(rng, config->mmax - config->mmin + 1);
+    b = random_divisor(config, rng);
+    s = (b < 0 ? -1 : +1);
+    // mod result always agrees in sign with divisor.
+    r = s * randint(rng, abs(b));
+    a = c * b + r;
+    break;
+  case QUOT_WITH_REM:
+    // Incorrect. What is (-23) quot (-7)? 3
+    // Incorrect. Login failed.
+    // In Haskell, both quot and div are 3 here.
+    // Something is wrong here...
+    c = config->mmin + randint(rng, config->mmax - config->mmin + 1);
+    b = random_divisor(config, rng);
+    // rem result always agrees in sign with dividend.
+    // The dividend is not computed yet though, but only the result is!
+    s = (b < 0 ? -1 : +1);
+    s *= (c < 0 ? -1 : c > 0 ? +1 : randint(rng, 2) * 2 - 1);
+    r = s * randint(rng, abs(b));
+    a = c * b + r;
+    break;
+  case CANCEL:
+    random_coprime_pair(config, rng, &a, &b);
+    if (b < 0) {
+      a = -a;
+      b = -b;
+    }
+    s = random_divisor(config, rng);
+    c = a;
+    c_den = b;
+    a *= s;
+    b *= s;
+    break;
+  default:
+    fprintf(stderr, "ERROR: unreachable code: unsupported operation: %d\n",
+            op);
+    return 0;
+  }
+  problem->op = op;
+  problem->a = a;
+  problem->b = b;
+  problem->c = c;
+  problem->c_den = c_den;
+  return 1;
+}
 
+// Formats the question like snprintf.
+static int format_question(const config_t *config, const problem_t *problem,
+                           char *buf, size_t size) {
   int a_neg_parens = 1;
-  int a, b, c = 0;
-  char *c_str = NULL;
   const char *op_prefix = "";
   const char *op_str = NULL;
   const char *op_suffix = "";
-  do {
-    int q, r, s;
-    switch (op) {
-    case ADD:
-      a = config->amin + randint(config->amax - config->amin + 1);
-      b = config->amin + randint(config->amax - config->amin + 1);
-      c = a + b;
-      op_str = "+";
-      break;
-    case SUB:
-      c = config->amin + randint(config->amax - config->amin + 1);
-      b = config->amin + randint(config->amax - config->amin + 1);
-      a = c + b;
-      op_str = "-";
-      break;
-    case MUL:
-      a = config->mmin + randint(config->mmax - config->mmin + 1);
-      b = config->mmin + randint(config->mmax - config->mmin + 1);
-      c = a * b;
-      if (config->use_utf8) {
-        op_str = "×";
-      } else {
-        op_str = "*";
-      }
-      break;
-    case DIV:
-      c = config->mmin + randint(config->mmax - config->mmin + 1);
-      b = config->mmin + randint(config->mmax - config->mmin + 1);
-      if (b == 0) {
-        continue;
-      }
-      a = c * b;
-      if (config->use_utf8) {
-        op_str = "÷";
-      } else {
-        op_str = "/";
-      }
-      break;
-    case MOD:
-      q = config->mmin + randint(config->mmax - config->mmin + 1);
-      b = config->mmin + randint(config->mmax - config->mmin + 1);
-      if (b == 0) {
-        continue;
-      }
-      s = (b < 0 ? -1 : +1);
-      // mod result always agrees in sign with divisor.
-      c = s * randint(abs(b));
-      a = q * b + c;
-      op_str = "mod";
-      break;
-    case REM:
-      q = config->mmin + randint(config->mmax - config->mmin + 1);
-      b = config->mmin + randint(config->mmax - config->mmin + 1);
-      if (b == 0) {
-        continue;
-      }
-      // rem result always agrees in sign with dividend.
-      // The dividend is not computed yet though, but only the result is!
-      s = (b < 0 ? -1 : +1);
-      s *= (q < 0 ? -1 : q > 0 ? +1 : randint(2) * 2 - 1);
-      c = s * randint(abs(b));
-      a = q * b + c;
-      op_str = "rem";
-      break;
-    case DIV_WITH_MOD:
-      c = config->mmin + randint(config->mmax - config->mmin + 1);
-      b = config->mmin + randint(config->mmax - config->mmin + 1);
-      if (b == 0) {
-        continue;
-      }
-      s = (b < 0 ? -1 : +1);
-      // mod result always agrees in sign with divisor.
-      r = s * randint(abs(b));
-      a = c * b + r;
-      if (config->use_utf8) {
-        op_prefix = "⌊";
-        op_str = "÷";
-        op_suffix = "⌋";
-      } else {
-        op_prefix = "floor(";
-        op_str = "/";
-        op_suffix = ")";
-      }
-      break;
-    case QUOT_WITH_REM:
-      // Incorrect. What is (-23) quot (-7)? 3
-      // Incorrect. Login failed.
-      // In Haskell, both quot and div are 3 here.
-      // Something is wrong here...
-      c = config->mmin + randint(config->mmax - config->mmin + 1);
-      b = config->mmin + randint(config->mmax - config->mmin + 1);
-      if (b == 0) {
-        continue;
-      }
-      // rem result always agrees in sign with dividend.
-      // The dividend is not computed yet though, but only the result is!
-      s = (b < 0 ? -1 : +1);
-      s *= (c < 0 ? -1 : c > 0 ? +1 : randint(2) * 2 - 1);
-      r = s * randint(abs(b));
-      a = c * b + r;
-      op_prefix = "[";
-      if (config->use_utf8) {
-        op_str = "÷";
-      } else {
-        op_str = "/";
-      }
-      op_suffix = "]";
-      break;
-    case CANCEL:
-      a = config->mmin + randint(config->mmax - config->mmin + 1);
-      b = config->mmin + randint(config->mmax - config->mmin + 1);
-      if (b == 0) {
-        continue;
-      }
-      if (gcd(a, b) != 1) {
-        continue;
-      }
-      if (b < 0) {
-        a = -a;
-        b = -b;
-      }
-      s = config->mmin + randint(config->mmax - config->mmin + 1);
-      if (s == 0) {
-        continue;
-      }
-      a_neg_parens = 0;
-      op_prefix = "the result of cancelling ";
+  switch (problem->op) {
+  case ADD:
+    op_str = "+";
+    break;
+  case SUB:
+    op_str = "-";
+    break;
+  case MUL:
+    if (config->use_utf8) {
+      op_str = "×";
+    } else {
+      op_str = "*";
+    }
+    break;
+  case DIV:
+    if (config->use_utf8) {
+      op_str = "÷";
+    } else {
       op_str = "/";
-      if (b == 1) {
-        c = a;
-      } else {
-        c_str = d0_asprintf("%d/%d", a, b);
-      }
-      a *= s;
-      b *= s;
-      break;
-    default:
-      fprintf(stderr, "ERROR: unreachable code: unsupported operation: %d\n",
-              op);
-      return NULL;
     }
-  } while (op_str == NULL);
+    break;
+  case MOD:
+    op_str = "mod";
+    break;
+  case REM:
+    op_str = "rem";
+    break;
+  case DIV_WITH_MOD:
+    if (config->use_utf8) {
+      op_prefix = "⌊";
+      op_str = "÷";
+      op_suffix = "⌋";
+    } else {
+      op_prefix = "floor(";
+      op_str = "/";
+      op_suffix = ")";
+    }
+    break;
+  case QUOT_WITH_REM:
+    op_prefix = "[";
+    if (config->use_utf8) {
+      op_str = "÷";
+    } else {
+      op_str = "/";
+    }
+    op_suffix = "]";
+    break;
+  default: // CANCEL
+    a_neg_parens = 0;
+    op_prefix = "the result of cancelling ";
+    op_str = "/";
+    break;
+  }
+  int a = problem->a, b = problem->b;
+  return snprintf(buf, size, "What is %s%s%d%s %s %s%d%s%s? ",
+                  op_prefix, //
+                  (a_neg_parens && a < 0) ? "(" : "", a,
+                  (a_neg_parens && a < 0) ? ")" : "",    //
+                  op_str,                                //
+                  b < 0 ? "(" : "", b, b < 0 ? ")" : "", //
+                  op_suffix);
+}
 
-  *answer_state = malloc(sizeof(answer_state_t));
+// Formats the answer like snprintf.
+static int format_answer(const problem_t *problem, char *buf, size_t size) {
+  if (problem->c_den != 1) {
+    return snprintf(buf, size, "%d/%d", problem->c, problem->c_den);
+  }
+  return snprintf(buf, size, "%d", problem->c);
+}
+
+char *make_question(config_t *config, random_t *rng, arena_t *arena,
+                    answer_state_t **answer_state) {
+  problem_t problem;
+  int op = config->op_table[randint(rng, config->op_table_size)];
+  if (!make_problem(config, rng, op, &problem)) {
+    return NULL;
+  }
+
+  char text[QUESTION_MAX];
+  *answer_state = arena_alloc(arena, sizeof(answer_state_t));
   if (*answer_state == NULL) {
     fprintf(stderr, "ERROR: could not allocate answer_state\n");
-    free(c_str);
     return NULL;
   }
-  (*answer_state)->answer_num = c;
-  (*answer_state)->answer_str = c_str;
-  return d0_asprintf("What is %s%s%d%s %s %s%d%s%s? ",
-                     op_prefix, //
-                     (a_neg_parens && a < 0) ? "(" : "", a,
-                     (a_neg_parens && a < 0) ? ")" : "",    //
-                     op_str,                                //
-                     b < 0 ? "(" : "", b, b < 0 ? ")" : "", //
-                     op_suffix);
+  (*answer_state)->answer_is_num = problem.c_den == 1;
+  (*answer_state)->answer_num = problem.c;
+  (*answer_state)->op = op;
+  format_answer(&problem, text, sizeof(text));
+  (*answer_state)->answer_str = arena_strndup(arena, text, strlen(text));
+  format_question(config, &problem, text, sizeof(text));
+  char *question = arena_strndup(arena, text, strlen(text));
+  if ((*answer_state)->answer_str == NULL || question == NULL) {
+    return NULL;
+  }
+  return question;
 }
 
-char *get_answer(answer_state_t *answer_state) {
-  if (answer_state->answer_str) {
-    return d0_strndup(answer_state->answer_str,
-                      strlen(answer_state->answer_str));
+// Problems made per round of make_question_records, before formatting them.
+#define RECORDS_CHUNK 32
+
+static int is_lane_op(int op) { return op == ADD || op == SUB || op == MUL; }
+
+// Makes RANDOM_LANES additions, subtractions or multiplications with the given
+// ops at once. Their operands are drawn and computed for all lanes together,
+// which compilers can turn into vector instructions.
+static void make_lane_problems(const config_t *config, random_lanes_t *lanes,
+                               const int ops[RANDOM_LANES],
+                               problem_t *problems[RANDOM_LANES]) {
+  uint32_t bounds[RANDOM_LANES];
+  int lo[RANDOM_LANES], x[RANDOM_LANES], y[RANDOM_LANES];
+  for (int l = 0; l < RANDOM_LANES; ++l) {
+    int additive = ops[l] == ADD || ops[l] == SUB;
+    lo[l] = additive ? config->amin : config->mmin;
+    bounds[l] = additive ? config->amax - config->amin + 1
+                         : config->mmax - config->mmin + 1;
+  }
+  randint_lanes(lanes, bounds, x);
+  randint_lanes(lanes, bounds, y);
+  for (int l = 0; l < RANDOM_LANES; ++l) {
+    int a = lo[l] + x[l], b = lo[l] + y[l];
+    // Unsigned, as the product may overflow in lanes that do not use it.
+    int product = (int)((unsigned)a * (unsigned)b);
+    problems[l]->op = ops[l];
+    problems[l]->a = (ops[l] == SUB) ? a + b : a;
+    problems[l]->b = b;
+    problems[l]->c = (ops[l] == ADD)   ? a + b
+                     : (ops[l] == SUB) ? a
+                                       : product;
+    problems[l]->c_den = 1;
   }
-  return d0_asprintf("%d", answer_state->answer_num);
 }
 
-int check_answer(answer_state_t *answer_state, const char *given) {
-  if (answer_state->answer_str) {
-    char *given_without_spaces = malloc(strlen(given) + 1);
-    const char *in = given;
-    char *out = given_without_spaces;
-    do {
-      if (isspace(*in)) {
-        continue;
+// Makes n problems. Ops are drawn from rng one by one; additions,
+// subtractions and multiplications are then made RANDOM_LANES at a time, and
+// the others, as well as the last few, one by one.
+static int make_problems(const config_t *config, random_t *rng,
+                         random_lanes_t *lanes, int n, problem_t *problems) {
+  int ops[RANDOM_LANES];
+  problem_t *pending[RANDOM_LANES];
+  int num_pending = 0;
+  for (int i = 0; i < n; ++i) {
+    int op = config->op_table[randint(rng, config->op_table_size)];
+    if (!is_lane_op(op)) {
+      if (!make_problem(config, rng, op, &problems[i])) {
+        return 0;
+      }
+      continue;
+    }
+    ops[num_pending] = op;
+    pending[num_pending++] = &problems[i];
+    if (num_pending == RANDOM_LANES) {
+      make_lane_problems(config, lanes, ops, pending);
+      num_pending = 0;
+    }
+  }
+  for (int l = 0; l < num_pending; ++l) {
+    if (!make_problem(config, rng, ops[l], pending[l])) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Takes a string of length len just formatted at *buf, or returns NULL if it
+// did not fit.
+static char *take(char **buf, size_t *size, int len) {
+  if (len < 0 || (size_t)len >= *size) {
+    return NULL;
+  }
+  char *s = *buf;
+  *buf += len + 1;
+  *size -= len + 1;
+  return s;
+}
+
+int make_question_records(config_t *config, random_t *rng,
+                          random_lanes_t *lanes, int n,
+                          question_record_t *records, char *buf,
+                          size_t size) {
+  if (config->op_table_size == 0) {
+    fprintf(stderr, "ERROR: no ops enabled\n");
+    return 0;
+  }
+  for (int i = 0; i < n; i += RECORDS_CHUNK) {
+    int chunk = (n - i < RECORDS_CHUNK) ? n - i : RECORDS_CHUNK;
+    problem_t problems[RECORDS_CHUNK];
+    if (!make_problems(config, rng, lanes, chunk, problems)) {
+      return 0;
+    }
+    for (int j = 0; j < chunk; ++j) {
+      question_record_t *record = &records[i + j];
+      record->question = take(
+          &buf, &size, format_question(config, &problems[j], buf, size));
+      if (record->question == NULL) {
+        return i + j;
       }
-      *out++ = *in;
-    } while (*in++);
-    int result = !strcmp(given_without_spaces, answer_state->answer_str);
-    free(given_without_spaces);
-    return result;
-  } else {
+      record->answer =
+          take(&buf, &size, format_answer(&problems[j], buf, size));
+      if (record->answer == NULL) {
+        return i + j;
+      }
+    }
+  }
+  return n;
+}
+
+int make_questions(config_t *config, random_t *rng, arena_t *arena, int n,
+                   char **questions, answer_state_t **answer_states) {
+  for (int i = 0; i < n; ++i) {
+    questions[i] = make_question(config, rng, arena, &answer_states[i]);
+    if (questions[i] == NULL) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+const char *get_answer(answer_state_t *answer_state) {
+  return answer_state->answer_str;
+}
+
+int answer_kind(answer_state_t *answer_state) { return answer_state->op; }
+
+int check_answer(answer_state_t *answer_state, const char *given) {
+  if (answer_state->answer_is_num) {
     int given_int;
     char too_much;
     if (sscanf(given, "%d%c", &given_int, &too_much) != 1) {
@@ -480,12 +774,18 @@ int check_answer(answer_state_t *answer_state, const char *given) {
     }
     return given_int == answer_state->answer_num;
   }
-}
-
-void free_answer(answer_state_t *answer_state) {
-  if (answer_state == NULL) {
-    return;
+  // Compare, skipping spaces in the given answer.
+  const char *expected = answer_state->answer_str;
+  for (const char *in = given;; ++in) {
+    if (isspace((unsigned char)*in)) {
+      continue;
+    }
+    if (*in != *expected) {
+      return 0;
+    }
+    if (*in == 0) {
+      return 1;
+    }
+    ++expected;
   }
-  free(answer_state->answer_str);
-  free(answer_state);
 }
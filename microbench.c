@@ -0,0 +1,304 @@
+#define _POSIX_C_SOURCE 200809L
+
+// Times the primitives the modules are built from, and writes the results as
+// JSON, to compare between commits.
+
+#include <math.h>   // for sqrt
+#include <stdio.h>  // for printf, fprintf, snprintf, fflush, stderr, ...
+#include <stdlib.h> // for free, qsort
+#include <string.h> // for memcpy, memset, strlen, strstr, strchr
+#include <time.h>   // for clock_gettime, timespec
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h> // for __rdtsc
+#endif
+
+#include "arena.h"     // for arena_free, arena_init, arena_t
+#include "csv.h"       // for csv_buf, csv_read, csv_start
+#include "helpers.h"   // for d0_asprintf, d0_strlcpy, randint, random_...
+#include "questions.h" // for build_config, check_answer, make_question, ...
+
+#define SAMPLES 15
+#define SAMPLE_MIN_NS 1000000
+#define LINE_MAX 8192
+#define RECORDS_BATCH 64
+
+typedef struct {
+  const char *name;
+  void (*run)(void *ctx, long iterations);
+  void *ctx;
+} benchmark_t;
+
+// Keeps results from being optimized away.
+static volatile unsigned long sink;
+
+static long long now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Reference cycles of the time stamp counter, or 0 where there is none.
+static unsigned long long now_cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+// csv_start and csv_read over a line. The line is copied first, as csv_read
+// unescapes quoted fields in place.
+static void run_csv(void *ctx, long iterations) {
+  const char *line = ctx;
+  size_t len = strlen(line);
+  char buf[LINE_MAX];
+  for (long i = 0; i < iterations; ++i) {
+    memcpy(buf, line, len);
+    csv_buf csv;
+    csv_start(buf, buf + len, &csv);
+    char *field;
+    while ((field = csv_read(&csv)) != NULL) {
+      sink += (unsigned char)*field;
+      free(field);
+    }
+  }
+}
+
+// d0_asprintf of a string argument.
+static void run_asprintf(void *ctx, long iterations) {
+  const char *arg = ctx;
+  for (long i = 0; i < iterations; ++i) {
+    char *s = d0_asprintf("%s %ld", arg, i);
+    sink += (unsigned char)*s;
+    free(s);
+  }
+}
+
+static void run_randint(void *ctx, long iterations) {
+  int n = *(const int *)ctx;
+  random_t rng;
+  random_init(&rng);
+  for (long i = 0; i < iterations; ++i) {
+    sink += randint(&rng, n);
+  }
+}
+
+typedef struct {
+  config_t *config;
+  answer_state_t *answer_state;
+  char answer[64];
+  arena_t arena;
+  char arena_buf[512];
+} math_t;
+
+static void run_check_answer(void *ctx, long iterations) {
+  math_t *math = ctx;
+  for (long i = 0; i < iterations; ++i) {
+    sink += check_answer(math->answer_state, math->answer);
+  }
+}
+
+static void run_make_question(void *ctx, long iterations) {
+  math_t *math = ctx;
+  random_t rng;
+  random_init(&rng);
+  for (long i = 0; i < iterations; ++i) {
+    arena_t arena;
+    char buf[512];
+    arena_init(&arena, buf, sizeof(buf));
+    answer_state_t *answer_state;
+    char *question = make_question(math->config, &rng, &arena, &answer_state);
+    sink += (question != NULL);
+    arena_free(&arena);
+  }
+}
+
+// Like run_make_question, but RECORDS_BATCH questions per call.
+static void run_make_question_records(void *ctx, long iterations) {
+  math_t *math = ctx;
+  random_t rng;
+  random_init(&rng);
+  random_lanes_t lanes;
+  random_lanes_fork(&rng, &lanes);
+  question_record_t records[RECORDS_BATCH];
+  static char buf[RECORDS_BATCH * 64];
+  for (long i = 0; i < iterations; i += RECORDS_BATCH) {
+    int n = (iterations - i < RECORDS_BATCH) ? iterations - i : RECORDS_BATCH;
+    sink += make_question_records(math->config, &rng, &lanes, n, records, buf,
+                                  sizeof(buf));
+  }
+}
+
+static int compare_double(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+// Runs a benchmark in samples long enough to time, after a warmup sample,
+// and writes its statistics as a JSON object.
+static void measure(const benchmark_t *benchmark, int first) {
+  long iterations = 1;
+  for (;;) {
+    long long start = now_ns();
+    benchmark->run(benchmark->ctx, iterations);
+    if (now_ns() - start >= SAMPLE_MIN_NS) {
+      break;
+    }
+    iterations *= 2;
+  }
+  double ns[SAMPLES], cycles[SAMPLES];
+  for (int i = -1; i < SAMPLES; ++i) {
+    long long start = now_ns();
+    unsigned long long start_cycles = now_cycles();
+    benchmark->run(benchmark->ctx, iterations);
+    unsigned long long end_cycles = now_cycles();
+    long long end = now_ns();
+    if (i >= 0) {
+      ns[i] = (double)(end - start) / iterations;
+      cycles[i] = (double)(end_cycles - start_cycles) / iterations;
+    }
+  }
+  double mean = 0, variance = 0;
+  for (int i = 0; i < SAMPLES; ++i) {
+    mean += ns[i] / SAMPLES;
+  }
+  for (int i = 0; i < SAMPLES; ++i) {
+    variance += (ns[i] - mean) * (ns[i] - mean) / (SAMPLES - 1);
+  }
+  qsort(ns, SAMPLES, sizeof(double), compare_double);
+  qsort(cycles, SAMPLES, sizeof(double), compare_double);
+  printf("%s    {\"name\": \"%s\", \"iterations\": %ld, \"samples\": %d, "
+         "\"ns_per_op\": {\"min\": %.3f, \"median\": %.3f, \"mean\": %.3f, "
+         "\"stddev\": %.3f, \"max\": %.3f}, ",
+         first ? "" : ",\n", benchmark->name, iterations, SAMPLES, ns[0],
+         ns[SAMPLES / 2], mean, sqrt(variance), ns[SAMPLES - 1]);
+  if (cycles[SAMPLES / 2] > 0) {
+    printf("\"cycles_per_op\": {\"min\": %.3f, \"median\": %.3f}}", cycles[0],
+           cycles[SAMPLES / 2]);
+  } else {
+    printf("\"cycles_per_op\": null}");
+  }
+  fflush(stdout);
+}
+
+// Builds a pam_math config for a single op, and an answer to check.
+static int init_math(math_t *math, const char *ops, int want_fraction) {
+  const char *argv[] = {ops, ".amin=-100", ".amax=100", ".mmin=-12",
+                        ".mmax=12"};
+  math->config = build_config("user", sizeof(argv) / sizeof(*argv), argv);
+  if (math->config == NULL) {
+    return 0;
+  }
+  random_t rng;
+  random_init(&rng);
+  arena_init(&math->arena, math->arena_buf, sizeof(math->arena_buf));
+  for (int tries = 0; tries < 1000; ++tries) {
+    arena_free(&math->arena);
+    if (make_question(math->config, &rng, &math->arena,
+                      &math->answer_state) == NULL) {
+      break;
+    }
+    const char *answer = get_answer(math->answer_state);
+    if ((strchr(answer, '/') != NULL) == want_fraction) {
+      d0_strlcpy(math->answer, answer, sizeof(math->answer));
+      return 1;
+    }
+  }
+  fprintf(stderr, "ERROR: could not make a question for %s\n", ops);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  static char pathological_quotes[LINE_MAX / 2];
+  static char pathological_long[LINE_MAX / 2];
+  static char pathological_fields[LINE_MAX / 2];
+  // A quoted field of escaped quotes, an unquoted field of 4 KiB and 2000
+  // empty fields.
+  pathological_quotes[0] = '"';
+  for (int i = 1; i < 2001; i += 2) {
+    pathological_quotes[i] = pathological_quotes[i + 1] = '"';
+  }
+  memcpy(pathological_quotes + 2001, "\",a,b", 6);
+  memset(pathological_long, 'x', sizeof(pathological_long) - 1);
+  memset(pathological_fields, ',', 2000);
+
+  static char medium_arg[100], large_arg[1000];
+  memset(medium_arg, 'm', sizeof(medium_arg) - 1);
+  memset(large_arg, 'l', sizeof(large_arg) - 1);
+  static const int bounds[] = {10, 1000, 2147483647};
+
+  static const struct {
+    const char *name;
+    const char *ops;
+  } ops[] = {{"add", ".ops=+"},
+             {"sub", ".ops=-"},
+             {"mul", ".ops=*"},
+             {"div", ".ops=/"},
+             {"mod", ".ops=m"},
+             {"rem", ".ops=r"},
+             {"div_with_mod", ".ops=d"},
+             {"quot_with_rem", ".ops=q"},
+             {"cancel", ".ops=c"}};
+  static math_t make_math[sizeof(ops) / sizeof(*ops)];
+  static math_t check_number, check_fraction;
+
+  benchmark_t benchmarks[64];
+  int num_benchmarks = 0;
+#define ADD_BENCHMARK(name, run, ctx)                                          \
+  benchmarks[num_benchmarks++] = (benchmark_t){name, run, (void *)(ctx)}
+  ADD_BENCHMARK("csv_read/plain", run_csv,
+                "What is the capital of Germany?,Berlin,capitals");
+  ADD_BENCHMARK("csv_read/quoted", run_csv,
+                "\"Say \"\"hello\"\", world:\",\"hello, world\",greetings");
+  ADD_BENCHMARK("csv_read/escaped_quotes", run_csv, pathological_quotes);
+  ADD_BENCHMARK("csv_read/long_field", run_csv, pathological_long);
+  ADD_BENCHMARK("csv_read/empty_fields", run_csv, pathological_fields);
+  ADD_BENCHMARK("d0_asprintf/small", run_asprintf, "s");
+  ADD_BENCHMARK("d0_asprintf/medium", run_asprintf, medium_arg);
+  ADD_BENCHMARK("d0_asprintf/large", run_asprintf, large_arg);
+  ADD_BENCHMARK("randint/10", run_randint, &bounds[0]);
+  ADD_BENCHMARK("randint/1000", run_randint, &bounds[1]);
+  ADD_BENCHMARK("randint/2147483647", run_randint, &bounds[2]);
+  if (!init_math(&check_number, ".ops=+", 0) ||
+      !init_math(&check_fraction, ".ops=c", 1)) {
+    return 1;
+  }
+  ADD_BENCHMARK("check_answer/number", run_check_answer, &check_number);
+  ADD_BENCHMARK("check_answer/fraction", run_check_answer, &check_fraction);
+  char names[sizeof(ops) / sizeof(*ops)][64];
+  char records_names[sizeof(ops) / sizeof(*ops)][64];
+  for (size_t i = 0; i < sizeof(ops) / sizeof(*ops); ++i) {
+    if (!init_math(&make_math[i], ops[i].ops, ops[i].ops[5] == 'c')) {
+      return 1;
+    }
+    snprintf(names[i], sizeof(names[i]), "make_question/%s", ops[i].name);
+    ADD_BENCHMARK(names[i], run_make_question, &make_math[i]);
+    snprintf(records_names[i], sizeof(records_names[i]),
+             "make_question_records/%s", ops[i].name);
+    ADD_BENCHMARK(records_names[i], run_make_question_records, &make_math[i]);
+  }
+#undef ADD_BENCHMARK
+
+  // Only run the benchmarks whose name contains an argument, if any.
+  printf("{\"benchmarks\": [\n");
+  int first = 1;
+  for (int i = 0; i < num_benchmarks; ++i) {
+    int selected = argc < 2;
+    for (int j = 1; j < argc; ++j) {
+      selected |= strstr(benchmarks[i].name, argv[j]) != NULL;
+    }
+    if (selected) {
+      measure(&benchmarks[i], first);
+      first = 0;
+    }
+  }
+  printf("\n]}\n");
+
+  free_config(check_number.config);
+  free_config(check_fraction.config);
+  for (size_t i = 0; i < sizeof(ops) / sizeof(*ops); ++i) {
+    free_config(make_math[i].config);
+  }
+  return 0;
+}
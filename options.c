@@ -0,0 +1,347 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "options.h"
+
+#include <ctype.h>    // for isspace
+#include <errno.h>    // for errno, EINTR
+#include <fcntl.h>    // for open, O_CLOEXEC, O_RDONLY
+#include <pthread.h>  // for pthread_mutex_lock, pthread_mutex_unlock, ...
+#include <stdint.h>   // for uint64_t
+#include <stdio.h>    // for fprintf, perror, stderr, NULL
+#include <stdlib.h>   // for free, calloc, realloc
+#include <string.h>   // for memcmp, memchr, strcmp, strlen, strncmp, strstr
+#include <sys/stat.h> // for fstat, stat
+#include <time.h>     // for timespec
+#include <unistd.h>   // for close, read
+
+#include "helpers.h" // for d0_asprintf, d0_strndup, hash_bytes
+
+#define CONFIG_DB_OPTION "config_db="
+
+// A config_db file: lines of "user field=value field=value ...", read into
+// memory, with a hash table from user names to lines. Never modified once
+// loaded; a changed file is loaded anew.
+typedef struct db_s {
+  char *name;
+  char *data;
+  size_t size;
+  size_t *slots; // Offset + 1 of the line of each user, or 0 if free.
+  size_t num_slots;
+  dev_t dev;
+  ino_t ino;
+  off_t file_size;
+  struct timespec mtime;
+  unsigned long serial;
+  int refs;
+} db_t;
+
+static pthread_mutex_t db_lock = PTHREAD_MUTEX_INITIALIZER;
+static db_t **dbs;
+static int num_dbs;
+static unsigned long db_serial;
+
+static int is_space(char c) { return isspace((unsigned char)c); }
+
+// Returns the end of the word at p, or end.
+static const char *word_end(const char *p, const char *end) {
+  while (p != end && !is_space(*p)) {
+    ++p;
+  }
+  return p;
+}
+
+static const char *skip_blanks(const char *p, const char *end) {
+  while (p != end && *p != '\n' && is_space(*p)) {
+    ++p;
+  }
+  return p;
+}
+
+static void free_db(db_t *db) {
+  free(db->data);
+  free(db->slots);
+  free(db->name);
+  free(db);
+}
+
+// Finds the slot for a user, which is free if the user has no line.
+static size_t find_slot(const db_t *db, const char *user, size_t len) {
+  size_t j = hash_bytes(user, len) & (db->num_slots - 1);
+  for (; db->slots[j] != 0; j = (j + 1) & (db->num_slots - 1)) {
+    const char *line = db->data + db->slots[j] - 1;
+    const char *end = db->data + db->size;
+    if ((size_t)(end - line) >= len && !memcmp(line, user, len) &&
+        word_end(line, end) == line + len) {
+      break;
+    }
+  }
+  return j;
+}
+
+static int index_db(db_t *db) {
+  const char *end = db->data + db->size;
+  size_t lines = 1;
+  for (const char *p = db->data; (p = memchr(p, '\n', end - p)) != NULL;
+       ++p) {
+    ++lines;
+  }
+  db->num_slots = 16;
+  while (db->num_slots < lines * 2) {
+    db->num_slots *= 2;
+  }
+  db->slots = calloc(db->num_slots, sizeof(*db->slots));
+  if (db->slots == NULL) {
+    fprintf(stderr, "ERROR: could not allocate config_db index\n");
+    return 0;
+  }
+  int line_number = 0;
+  for (const char *line = db->data; line != end;) {
+    const char *eol = memchr(line, '\n', end - line);
+    const char *next = (eol == NULL) ? end : eol + 1;
+    ++line_number;
+    const char *user = skip_blanks(line, next);
+    if (user == next || *user == '\n' || *user == '#') {
+      line = next;
+      continue;
+    }
+    size_t len = word_end(user, end) - user;
+    size_t j = find_slot(db, user, len);
+    if (db->slots[j] != 0) {
+      fprintf(stderr, "WARNING: duplicate user in %s line %d ignored\n",
+              db->name, line_number);
+    } else {
+      db->slots[j] = user - db->data + 1;
+    }
+    line = next;
+  }
+  return 1;
+}
+
+// Reads the rest of a file into allocated memory, starting with room for size
+// bytes. Copying rather than mapping it keeps logins safe from the file being
+// edited in place. Returns NULL on failure.
+static char *read_file(int fd, size_t size, size_t *len) {
+  char *data = NULL;
+  *len = 0;
+  for (;;) {
+    if (*len == size || data == NULL) {
+      size = (*len == size) ? size * 2 : size;
+      char *new_data = realloc(data, size);
+      if (new_data == NULL) {
+        fprintf(stderr, "ERROR: could not allocate config_db\n");
+        free(data);
+        return NULL;
+      }
+      data = new_data;
+    }
+    ssize_t n = read(fd, data + *len, size - *len);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      perror("ERROR: could not read config_db");
+      free(data);
+      return NULL;
+    }
+    if (n == 0) {
+      return data;
+    }
+    *len += n;
+  }
+}
+
+static db_t *load_db(const char *name) {
+  db_t *db = calloc(1, sizeof(*db));
+  if (db == NULL) {
+    fprintf(stderr, "ERROR: could not allocate config_db\n");
+    return NULL;
+  }
+  db->name = d0_strndup(name, strlen(name));
+  db->refs = 1;
+  int fd = open(name, O_RDONLY | O_CLOEXEC);
+  if (db->name == NULL || fd < 0) {
+    perror("ERROR: could not open config_db");
+    free_db(db);
+    return NULL;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    perror("ERROR: could not stat config_db");
+    close(fd);
+    free_db(db);
+    return NULL;
+  }
+  // If the file changes while being read, it no longer matches this and is
+  // loaded again next time.
+  db->dev = st.st_dev;
+  db->ino = st.st_ino;
+  db->file_size = st.st_size;
+  db->mtime = st.st_mtim;
+  // One more byte than expected, so that reaching the end takes no realloc.
+  db->data = read_file(fd, st.st_size + 1, &db->size);
+  if (db->data == NULL) {
+    close(fd);
+    free_db(db);
+    return NULL;
+  }
+  close(fd);
+  if (!index_db(db)) {
+    free_db(db);
+    return NULL;
+  }
+  return db;
+}
+
+static int unchanged(const db_t *db) {
+  struct stat st;
+  return stat(db->name, &st) == 0 && st.st_dev == db->dev &&
+         st.st_ino == db->ino && st.st_size == db->file_size &&
+         st.st_mtim.tv_sec == db->mtime.tv_sec &&
+         st.st_mtim.tv_nsec == db->mtime.tv_nsec;
+}
+
+static void release_db(db_t *db);
+
+// Returns the current version of a config_db file, loading it if needed. The
+// lock is only held to look it up and to publish a newly loaded version, so
+// that file I/O never holds up other logins.
+static db_t *acquire_db(const char *name) {
+  pthread_mutex_lock(&db_lock);
+  db_t *db = NULL;
+  for (int i = 0; i < num_dbs; ++i) {
+    if (!strcmp(dbs[i]->name, name)) {
+      db = dbs[i];
+      ++db->refs;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&db_lock);
+  if (db != NULL) {
+    if (unchanged(db)) {
+      return db;
+    }
+    release_db(db);
+  }
+
+  db = load_db(name);
+  if (db == NULL) {
+    return NULL;
+  }
+  pthread_mutex_lock(&db_lock);
+  db->serial = ++db_serial;
+  int index = -1;
+  for (int i = 0; i < num_dbs; ++i) {
+    if (!strcmp(dbs[i]->name, name)) {
+      index = i;
+      break;
+    }
+  }
+  if (index >= 0) {
+    if (--dbs[index]->refs == 0) {
+      free_db(dbs[index]);
+    }
+    dbs[index] = db;
+    ++db->refs;
+  } else {
+    db_t **new_dbs = realloc(dbs, (num_dbs + 1) * sizeof(*dbs));
+    if (new_dbs != NULL) {
+      dbs = new_dbs;
+      dbs[num_dbs++] = db;
+      ++db->refs;
+    }
+  }
+  pthread_mutex_unlock(&db_lock);
+  return db;
+}
+
+static void release_db(db_t *db) {
+  pthread_mutex_lock(&db_lock);
+  if (--db->refs == 0) {
+    free_db(db);
+  }
+  pthread_mutex_unlock(&db_lock);
+}
+
+// Returns the config_db file named by a .config_db= or user.config_db=
+// argument, if any.
+static const char *db_name(const char *arg) {
+  const char *option = strstr(arg, "." CONFIG_DB_OPTION);
+  if (option == NULL || memchr(arg, '=', option - arg) != NULL) {
+    return NULL;
+  }
+  return option + 1 + strlen(CONFIG_DB_OPTION);
+}
+
+static void for_each_db_option(const char *user, const char *name,
+                               void (*fn)(void *ctx, const char *field,
+                                          const char *arg),
+                               void *ctx) {
+  db_t *db = acquire_db(name);
+  if (db == NULL) {
+    return;
+  }
+  size_t len = strlen(user);
+  size_t j = find_slot(db, user, len);
+  if (db->slots[j] != 0) {
+    const char *end = db->data + db->size;
+    const char *p = db->data + db->slots[j] - 1 + len;
+    for (;;) {
+      p = skip_blanks(p, end);
+      if (p == end || *p == '\n') {
+        break;
+      }
+      const char *field_end = word_end(p, end);
+      // Pass it on like a user.field=value argument.
+      char *arg = d0_asprintf("%s.%.*s", user, (int)(field_end - p), p);
+      if (arg == NULL) {
+        break;
+      }
+      if (db_name(arg) != NULL) {
+        fprintf(stderr, "Unexpected option in %s: %s\n", name, arg);
+      } else {
+        fn(ctx, arg + len + 1, arg);
+      }
+      free(arg);
+      p = field_end;
+    }
+  }
+  release_db(db);
+}
+
+void for_each_option(const char *user, int argc, const char **argv,
+                     void (*fn)(void *ctx, const char *field, const char *arg),
+                     void *ctx) {
+  size_t userlen = strlen(user);
+  for (int i = 0; i < argc; ++i) {
+    const char *arg = argv[i];
+    const char *field;
+    if (arg[0] == '.') {
+      field = arg + 1;
+    } else if (!strncmp(arg, user, userlen) && arg[userlen] == '.') {
+      field = arg + userlen + 1;
+    } else {
+      continue;
+    }
+    if (!strncmp(field, CONFIG_DB_OPTION, strlen(CONFIG_DB_OPTION))) {
+      for_each_db_option(user, field + strlen(CONFIG_DB_OPTION), fn, ctx);
+      continue;
+    }
+    fn(ctx, field, arg);
+  }
+}
+
+unsigned long options_version(int argc, const char **argv) {
+  unsigned long version = 0;
+  for (int i = 0; i < argc; ++i) {
+    const char *name = db_name(argv[i]);
+    if (name == NULL) {
+      continue;
+    }
+    db_t *db = acquire_db(name);
+    version = version * 31 + ((db == NULL) ? 0 : db->serial);
+    if (db != NULL) {
+      release_db(db);
+    }
+  }
+  return version;
+}
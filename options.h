@@ -0,0 +1,16 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+// Calls fn for every option that applies to user, in order. These are the
+// module arguments of the form .field=value and user.field=value, and, in
+// place of a config_db=file argument, the fields listed for the user in that
+// file. field points to the field=value part of arg.
+void for_each_option(const char *user, int argc, const char **argv,
+                     void (*fn)(void *ctx, const char *field, const char *arg),
+                     void *ctx);
+
+// Returns a number that changes whenever a config_db file named in the
+// arguments changes, so that configs built from it can be told apart.
+unsigned long options_version(int argc, const char **argv);
+
+#endif
@@ -0,0 +1,193 @@
+#define _POSIX_C_SOURCE 200809L
+
+// Prints the counters files of the modules in the text format of the
+// Prometheus node_exporter textfile collector.
+
+#include <fcntl.h>    // for open, O_CLOEXEC, O_RDONLY
+#include <stddef.h>   // for offsetof, size_t
+#include <stdint.h>   // for uint64_t
+#include <stdio.h>    // for printf, fprintf, perror, putchar, stderr
+#include <sys/mman.h> // for mmap, munmap, MAP_FAILED, MAP_SHARED, PROT_READ
+#include <sys/stat.h> // for fstat, stat
+#include <unistd.h>   // for close
+
+#include "counters.h" // for counters_t, counters_magic, COUNTERS_KINDS
+#include "stats.h"    // for stats_phase_name, STATS_BUCKETS, STATS_PHASES
+
+#define FILES_MAX 64
+
+typedef struct {
+  const char *module;
+  const char *const *kinds;
+  int num_kinds;
+} module_t;
+
+// In the order of the ops enum of math_questions.c.
+static const char *const math_kinds[] = {
+    "add", "sub", "mul", "div", "mod", "rem", "div_with_mod", "quot_with_rem",
+    "cancel"};
+static const char *const file_kinds[] = {"question"};
+
+static const module_t modules[] = {
+    {"pam_math", math_kinds, sizeof(math_kinds) / sizeof(*math_kinds)},
+    {"pam_questions_file", file_kinds,
+     sizeof(file_kinds) / sizeof(*file_kinds)}};
+
+typedef struct {
+  const char *name;
+  const module_t *module;
+  const counters_t *counters;
+} file_t;
+
+static uint64_t load(const uint64_t *counter) {
+  return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+static const counters_t *map_file(const char *name, const module_t **module) {
+  int fd = open(name, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    perror(name);
+    return NULL;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(counters_t)) {
+    fprintf(stderr, "ERROR: %s is too small for counters\n", name);
+    close(fd);
+    return NULL;
+  }
+  void *data = mmap(NULL, sizeof(counters_t), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    perror(name);
+    return NULL;
+  }
+  const counters_t *counters = data;
+  uint64_t magic = load(&counters->magic);
+  for (size_t i = 0; i < sizeof(modules) / sizeof(*modules); ++i) {
+    if (magic == counters_magic(modules[i].module)) {
+      *module = &modules[i];
+      return counters;
+    }
+  }
+  fprintf(stderr, "ERROR: %s holds no counters of a known module\n", name);
+  munmap(data, sizeof(counters_t));
+  return NULL;
+}
+
+// Prints the labels identifying a file, escaping the name.
+static void print_labels(const file_t *file) {
+  printf("module=\"%s\",file=\"", file->module->module);
+  for (const char *p = file->name; *p; ++p) {
+    if (*p == '\\' || *p == '"') {
+      printf("\\%c", *p);
+    } else if (*p == '\n') {
+      printf("\\n");
+    } else {
+      putchar(*p);
+    }
+  }
+  putchar('"');
+}
+
+static void print_header(const char *name, const char *type,
+                         const char *help) {
+  printf("# HELP pam_math_%s %s\n# TYPE pam_math_%s %s\n", name, help, name,
+         type);
+}
+
+static void print_counter(const file_t *files, int num_files,
+                          const char *name, const char *help, size_t offset) {
+  print_header(name, "counter", help);
+  for (int i = 0; i < num_files; ++i) {
+    printf("pam_math_%s{", name);
+    print_labels(&files[i]);
+    printf("} %llu\n",
+           (unsigned long long)load(
+               (const uint64_t *)((const char *)files[i].counters + offset)));
+  }
+}
+
+static void print_answers(const file_t *files, int num_files) {
+  print_header("answers_total", "counter",
+               "Answers checked, by kind of question and result.");
+  for (int i = 0; i < num_files; ++i) {
+    const file_t *file = &files[i];
+    for (int k = 0; k < file->module->num_kinds && k < COUNTERS_KINDS; ++k) {
+      printf("pam_math_answers_total{");
+      print_labels(file);
+      printf(",kind=\"%s\",result=\"correct\"} %llu\n", file->module->kinds[k],
+             (unsigned long long)load(&file->counters->correct[k]));
+      printf("pam_math_answers_total{");
+      print_labels(file);
+      printf(",kind=\"%s\",result=\"incorrect\"} %llu\n",
+             file->module->kinds[k],
+             (unsigned long long)load(&file->counters->incorrect[k]));
+    }
+  }
+}
+
+static void print_phases(const file_t *files, int num_files) {
+  print_header("phase_seconds", "histogram",
+               "Time taken by each phase of authentication.");
+  for (int i = 0; i < num_files; ++i) {
+    const file_t *file = &files[i];
+    for (int phase = 0; phase < STATS_PHASES; ++phase) {
+      const char *name = stats_phase_name(phase);
+      unsigned long long count = 0;
+      for (int b = 0; b < STATS_BUCKETS; ++b) {
+        count += load(&file->counters->buckets[phase][b]);
+        printf("pam_math_phase_seconds_bucket{");
+        print_labels(file);
+        if (b == STATS_BUCKETS - 1) {
+          printf(",phase=\"%s\",le=\"+Inf\"} %llu\n", name, count);
+        } else {
+          printf(",phase=\"%s\",le=\"%.9g\"} %llu\n", name,
+                 (double)(2ULL << b) / 1e9, count);
+        }
+      }
+      printf("pam_math_phase_seconds_sum{");
+      print_labels(file);
+      printf(",phase=\"%s\"} %.9f\n", name,
+             load(&file->counters->total_ns[phase]) / 1e9);
+      printf("pam_math_phase_seconds_count{");
+      print_labels(file);
+      printf(",phase=\"%s\"} %llu\n", name, count);
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2 || argc - 1 > FILES_MAX) {
+    fprintf(stderr, "Usage: %s counters_file... > pam_math.prom\n", argv[0]);
+    return 1;
+  }
+  file_t files[FILES_MAX];
+  int num_files = 0;
+  int status = 0;
+  for (int i = 1; i < argc; ++i) {
+    file_t *file = &files[num_files];
+    file->name = argv[i];
+    file->counters = map_file(argv[i], &file->module);
+    if (file->counters == NULL) {
+      status = 1;
+      continue;
+    }
+    ++num_files;
+  }
+  print_counter(files, num_files, "sessions_total",
+                "Conversations started.", offsetof(counters_t, sessions));
+  print_counter(files, num_files, "questions_total", "Questions made.",
+                offsetof(counters_t, questions));
+  print_counter(files, num_files, "exhausted_total",
+                "Questions whose attempts ran out.",
+                offsetof(counters_t, exhausted));
+  print_counter(files, num_files, "conv_again_total",
+                "Conversations suspended by PAM_CONV_AGAIN.",
+                offsetof(counters_t, conv_again));
+  print_counter(files, num_files, "config_errors_total",
+                "Failures to get the config.",
+                offsetof(counters_t, config_errors));
+  print_answers(files, num_files);
+  print_phases(files, num_files);
+  return status;
+}
@@ -1,13 +1,341 @@
 #include <security/_pam_types.h>  // for PAM_CONV_AGAIN, PAM_INCOMPLETE
 #include <security/pam_appl.h>    // for pam_response, PAM_SUCCESS, pam_mes...
+#include <security/pam_ext.h>     // for pam_syslog
 #include <security/pam_modules.h> // for pam_handle_t, PAM_EXTERN, pam_get_...
 #include <stdio.h>                // for fprintf, NULL, stderr
-#include <stdlib.h>               // for free
+#include <stdlib.h>               // for free, calloc
+#include <string.h>               // for memset, strncmp
+#include <syslog.h>               // for LOG_INFO
 
-#include "helpers.h"   // for d0_asprintf, maybe_init_random
-#include "questions.h" // for free_answer, build_config, check_a...
+#include "arena.h"        // for arena_alloc, arena_asprintf, arena_calloc
+#include "config_cache.h" // for config_acquire, config_release, config_...
+#include "counters.h"     // for COUNTERS_ADD, counters_t, counters_add_...
+#include "helpers.h"      // for d0_strlcpy, random_init, random_t
+#include "options.h"      // for for_each_option
+#include "questions.h"    // for check_answer, config_t, get_answer, ...
+#include "stats.h"        // for stats_add, stats_start, stats_t, STATS_...
 
-static int ask_questions(pam_handle_t *pamh, config_t *config) {
+// Memory on the PAM handle for the allocations of a conversation, which
+// usually suffices.
+#define ARENA_INITIAL 2048
+
+// Long enough for the stats of a phase.
+#define STATS_LINE_MAX 2048
+
+// Long enough for the name of a counters file.
+#define COUNTERS_FILE_MAX 4096
+
+// The conversation of an authentication, kept on the PAM handle. If the
+// conversation fails with PAM_CONV_AGAIN, the next call resumes it where it
+// stopped, without making new questions.
+typedef struct {
+  config_entry_t *config_entry; // NULL if no conversation is in progress.
+  config_t *config;
+  int n;
+  char **questions;
+  answer_state_t **answer_states;
+  // The question to ask next, and how often it was asked already. In batched
+  // mode, only attempt is used.
+  int index;
+  int attempt;
+  // Batched mode: the questions not answered correctly yet.
+  int *pending;
+  int num_pending;
+  // Everything above, as well as the messages, is allocated from here.
+  arena_t arena;
+  char arena_buf[ARENA_INITIAL];
+  // Times of the phases of the conversation, if the config asks for them or
+  // for counters. NULL otherwise.
+  stats_t *stats;
+  stats_t stats_buf;
+  int log_stats;
+  counters_t *counters; // NULL unless the config asks for counters.
+} handle_state_t;
+
+static void log_stats(pam_handle_t *pamh, const stats_t *stats) {
+  for (int phase = 0; phase < STATS_PHASES; ++phase) {
+    char line[STATS_LINE_MAX];
+    if (stats_format(stats, phase, line, sizeof(line)) > 0) {
+      pam_syslog(pamh, LOG_INFO, "stats: %s", line);
+    }
+  }
+}
+
+static void end_conversation(pam_handle_t *pamh, handle_state_t *state) {
+  if (state->config_entry == NULL) {
+    return;
+  }
+  arena_free(&state->arena);
+  long long start = stats_start(state->stats);
+  config_release(state->config_entry);
+  stats_add(state->stats, STATS_FREE_CONFIG, start, 1);
+  if (state->log_stats) {
+    log_stats(pamh, state->stats);
+  }
+  if (state->counters != NULL) {
+    counters_add_stats(state->counters, state->stats);
+  }
+  state->config_entry = NULL;
+  state->config = NULL;
+}
+
+static void free_handle_state(pam_handle_t *pamh, void *data,
+                              int error_status __attribute__((unused))) {
+  end_conversation(pamh, data);
+  free(data);
+}
+
+static handle_state_t *get_handle_state(pam_handle_t *pamh) {
+  const void *data;
+  if (pam_get_data(pamh, module_name, &data) == PAM_SUCCESS && data != NULL) {
+    return (handle_state_t *)data;
+  }
+  handle_state_t *state = calloc(1, sizeof(*state));
+  if (state == NULL) {
+    fprintf(stderr, "ERROR: could not allocate handle state\n");
+    return NULL;
+  }
+  int retval = pam_set_data(pamh, module_name, state, free_handle_state);
+  if (retval != PAM_SUCCESS) {
+    fprintf(stderr, "ERROR: could not set PAM data: %s\n",
+            pam_strerror(pamh, retval));
+    free(state);
+    return NULL;
+  }
+  return state;
+}
+
+static void find_counters_file(void *ctx, const char *field,
+                               const char *arg __attribute__((unused))) {
+  if (!strncmp(field, "counters=", 9)) {
+    d0_strlcpy(ctx, field + 9, COUNTERS_FILE_MAX);
+  }
+}
+
+// Counts a config that could not be built, looking for the counters file in
+// the arguments, as there is no config to tell it.
+static void count_config_error(const char *user, int argc, const char **argv) {
+  char name[COUNTERS_FILE_MAX] = "";
+  for_each_option(user, argc, argv, find_counters_file, name);
+  if (*name != 0) {
+    COUNTERS_ADD(counters_open(name, module_name), config_errors, 1);
+  }
+}
+
+// Gets the config and makes the questions of a new conversation.
+static int start_conversation(handle_state_t *state, const char *user,
+                              int argc, const char **argv) {
+  // Timed before knowing whether stats are wanted, which is up to the config.
+  long long start = stats_start(&state->stats_buf);
+  config_entry_t *config_entry;
+  config_t *config = config_acquire(user, argc, argv, &config_entry);
+  if (config == NULL) {
+    fprintf(stderr, "ERROR: could not get config\n");
+    count_config_error(user, argc, argv);
+    return PAM_SERVICE_ERR;
+  }
+  counters_t *counters = NULL;
+  if (counters_file(config) != NULL) {
+    counters = counters_open(counters_file(config), module_name);
+  }
+  stats_t *stats = (collect_stats(config) || counters != NULL)
+                       ? &state->stats_buf
+                       : NULL;
+  stats_add(stats, STATS_BUILD_CONFIG, start, 1);
+
+  int n = num_questions(config);
+  if (n < 0) {
+    n = 0;
+  }
+  arena_t *arena = &state->arena;
+  arena_init(arena, state->arena_buf, sizeof(state->arena_buf));
+  char **questions = arena_calloc(arena, n + 1, sizeof(char *));
+  answer_state_t **answer_states =
+      arena_calloc(arena, n + 1, sizeof(answer_state_t *));
+  int *pending = arena_calloc(arena, n + 1, sizeof(int));
+  if (questions == NULL || answer_states == NULL || pending == NULL) {
+    arena_free(arena);
+    config_release(config_entry);
+    fprintf(stderr, "ERROR: could not allocate questions\n");
+    return PAM_SERVICE_ERR;
+  }
+  random_t rng;
+  random_init(&rng);
+  // The questions are made at once, so each is counted with the average time.
+  start = stats_start(stats);
+  if (n > 0 &&
+      !make_questions(config, &rng, arena, n, questions, answer_states)) {
+    arena_free(arena);
+    config_release(config_entry);
+    fprintf(stderr, "ERROR: could not generate questions\n");
+    return PAM_SERVICE_ERR;
+  }
+  stats_add(stats, STATS_MAKE_QUESTION, start, n);
+  COUNTERS_ADD(counters, sessions, 1);
+  COUNTERS_ADD(counters, questions, n);
+  for (int i = 0; i < n; ++i) {
+    pending[i] = i;
+  }
+
+  state->config_entry = config_entry;
+  state->config = config;
+  state->n = n;
+  state->questions = questions;
+  state->answer_states = answer_states;
+  state->index = 0;
+  state->attempt = 0;
+  state->pending = pending;
+  state->num_pending = n;
+  state->stats = stats;
+  state->log_stats = collect_stats(config);
+  state->counters = counters;
+  return PAM_SUCCESS;
+}
+
+// Sends n messages of the given style in a single conversation call. The
+// responses are only returned for prompts, and must be freed then.
+static int converse(const struct pam_conv *conv, handle_state_t *state, int n,
+                    int style, char **texts, struct pam_response **resp) {
+  struct pam_message *msgs = arena_alloc(&state->arena, n * sizeof(*msgs));
+  const struct pam_message **pmsgs =
+      arena_alloc(&state->arena, n * sizeof(*pmsgs));
+  if (msgs == NULL || pmsgs == NULL) {
+    fprintf(stderr, "ERROR: could not allocate messages\n");
+    return PAM_BUF_ERR;
+  }
+  // Works with both Linux-PAM's and Solaris' idea of the layout.
+  for (int i = 0; i < n; ++i) {
+    msgs[i].msg_style = style;
+    msgs[i].msg = texts[i];
+    pmsgs[i] = &msgs[i];
+  }
+  *resp = NULL;
+  long long start = stats_start(state->stats);
+  int retval = conv->conv(n, pmsgs, resp, conv->appdata_ptr);
+  stats_add(state->stats, STATS_CONV, start, 1);
+  if (style != PAM_PROMPT_ECHO_ON && *resp != NULL) {
+    for (int i = 0; i < n; ++i) {
+      free((*resp)[i].resp);
+    }
+    free(*resp);
+    *resp = NULL;
+  }
+  return retval;
+}
+
+static void count_answer(handle_state_t *state, answer_state_t *answer_state,
+                         int ok) {
+  int kind = answer_kind(answer_state);
+  if (kind < 0 || kind >= COUNTERS_KINDS) {
+    return;
+  }
+  if (ok) {
+    COUNTERS_ADD(state->counters, correct[kind], 1);
+  } else {
+    COUNTERS_ADD(state->counters, incorrect[kind], 1);
+  }
+}
+
+// Tells the correct answers to the given questions, and that login failed.
+// Returns PAM_AUTH_ERR, or the error of the conversation if it failed.
+static int tell_answers(const struct pam_conv *conv, handle_state_t *state,
+                        const int *which, int n) {
+  COUNTERS_ADD(state->counters, exhausted, n);
+  char **texts = arena_alloc(&state->arena, n * sizeof(char *));
+  if (texts == NULL) {
+    fprintf(stderr, "ERROR: could not allocate messages\n");
+    return PAM_AUTH_ERR;
+  }
+  for (int k = 0; k < n; ++k) {
+    texts[k] = arena_asprintf(
+        &state->arena, "Incorrect. Correct would have been: %s.%s",
+        get_answer(state->answer_states[which[k]]),
+        (k == n - 1) ? " Login failed." : "");
+    if (texts[k] == NULL) {
+      return PAM_AUTH_ERR;
+    }
+  }
+  struct pam_response *resp;
+  int retval = converse(conv, state, n, PAM_ERROR_MSG, texts, &resp);
+  // Failing to tell the answers is an error of its own, but there is no
+  // point in resuming just for that.
+  if (retval != PAM_SUCCESS && retval != PAM_CONV_AGAIN) {
+    return retval;
+  }
+  return PAM_AUTH_ERR;
+}
+
+// Asks all questions at once, and then all questions answered incorrectly
+// again, so that remote logins take a single round trip per attempt.
+static int ask_questions_batched(pam_handle_t *pamh,
+                                 const struct pam_conv *conv,
+                                 handle_state_t *state) {
+  for (; state->attempt < num_attempts(state->config) &&
+         state->num_pending > 0;
+       ++state->attempt) {
+    const char *prefix = (state->attempt == 0) ? "" : "Incorrect. ";
+    char **texts =
+        arena_alloc(&state->arena, state->num_pending * sizeof(char *));
+    if (texts == NULL) {
+      fprintf(stderr, "ERROR: could not allocate questions\n");
+      return PAM_SERVICE_ERR;
+    }
+    for (int k = 0; k < state->num_pending; ++k) {
+      texts[k] = arena_asprintf(&state->arena, "%s%s", prefix,
+                                state->questions[state->pending[k]]);
+      if (texts[k] == NULL) {
+        fprintf(stderr, "ERROR: could not prefix question\n");
+        return PAM_SERVICE_ERR;
+      }
+    }
+
+    struct pam_response *resp;
+    int retval = converse(conv, state, state->num_pending, PAM_PROMPT_ECHO_ON,
+                          texts, &resp);
+    if (retval != PAM_SUCCESS) {
+      if (retval == PAM_CONV_AGAIN) {
+        return PAM_INCOMPLETE;
+      }
+      fprintf(stderr, "ERROR: could not get PAM conversation: %s\n",
+              pam_strerror(pamh, retval));
+      return retval;
+    }
+    if (resp == NULL) {
+      fprintf(stderr, "ERROR: could not get a response: got NULL\n");
+      return PAM_SERVICE_ERR;
+    }
+
+    int num_failed = 0;
+    for (int k = 0; k < state->num_pending; ++k) {
+      int i = state->pending[k];
+      if (resp[k].resp == NULL) {
+        fprintf(stderr, "ERROR: could not get a response: got NULL\n");
+        retval = PAM_SERVICE_ERR;
+        continue;
+      }
+      long long start = stats_start(state->stats);
+      int ok = check_answer(state->answer_states[i], resp[k].resp);
+      stats_add(state->stats, STATS_CHECK_ANSWER, start, 1);
+      count_answer(state, state->answer_states[i], ok);
+      if (!ok) {
+        state->pending[num_failed++] = i;
+      }
+      free(resp[k].resp);
+    }
+    free(resp);
+    if (retval != PAM_SUCCESS) {
+      return retval;
+    }
+    state->num_pending = num_failed;
+  }
+
+  if (state->num_pending > 0) {
+    return tell_answers(conv, state, state->pending, state->num_pending);
+  }
+  return PAM_SUCCESS;
+}
+
+static int ask_questions(pam_handle_t *pamh, handle_state_t *state) {
   const void *convp;
   int retval = pam_get_item(pamh, PAM_CONV, &convp);
   if (retval != PAM_SUCCESS) {
@@ -21,39 +349,29 @@ static int ask_questions(pam_handle_t *pamh, config_t *config) {
     return PAM_SERVICE_ERR;
   }
 
-  for (int i = 0; i < num_questions(config); ++i) {
-    answer_state_t *answer_state = NULL;
-    char *question = make_question(config, &answer_state);
-    if (question == NULL) {
-      free_answer(answer_state);
-      fprintf(stderr, "ERROR: could not generate question\n");
-      return PAM_SERVICE_ERR;
-    }
+  if (batch_prompts(state->config)) {
+    return ask_questions_batched(pamh, conv, state);
+  }
+
+  for (; state->index < state->n; ++state->index, state->attempt = 0) {
+    const char *question = state->questions[state->index];
+    answer_state_t *answer_state = state->answer_states[state->index];
 
-    for (int j = 0; j < num_attempts(config); ++j) {
-      const char *prefix = (j == 0) ? "" : "Incorrect. ";
-      char *msg_question = d0_asprintf("%s%s", prefix, question);
+    for (; state->attempt < num_attempts(state->config); ++state->attempt) {
+      const char *prefix = (state->attempt == 0) ? "" : "Incorrect. ";
+      char *msg_question =
+          arena_asprintf(&state->arena, "%s%s", prefix, question);
       if (msg_question == NULL) {
-        free(question);
-        free_answer(answer_state);
         fprintf(stderr, "ERROR: could not prefix question\n");
         return PAM_SERVICE_ERR;
       }
 
-      struct pam_message msg;
-      const struct pam_message *pmsg = &msg;
-      struct pam_response *resp = NULL;
-      msg.msg_style = PAM_PROMPT_ECHO_ON;
-      msg.msg = msg_question;
-      retval = conv->conv(1, &pmsg, &resp, conv->appdata_ptr);
-
-      free(msg_question);
+      struct pam_response *resp;
+      retval =
+          converse(conv, state, 1, PAM_PROMPT_ECHO_ON, &msg_question, &resp);
 
       if (retval != PAM_SUCCESS) {
-        free(question);
-        free_answer(answer_state);
         if (retval == PAM_CONV_AGAIN) {
-          skip_next_init_random();
           return PAM_INCOMPLETE;
         }
         fprintf(stderr, "ERROR: could not get PAM conversation: %s\n",
@@ -61,13 +379,15 @@ static int ask_questions(pam_handle_t *pamh, config_t *config) {
         return retval;
       }
       if (resp == NULL || resp[0].resp == NULL) {
-        free(question);
-        free_answer(answer_state);
         fprintf(stderr, "ERROR: could not get a response: got NULL\n");
+        free(resp);
         return PAM_SERVICE_ERR;
       }
 
+      long long start = stats_start(state->stats);
       int ok = check_answer(answer_state, resp[0].resp);
+      stats_add(state->stats, STATS_CHECK_ANSWER, start, 1);
+      count_answer(state, answer_state, ok);
 
       free(resp[0].resp);
       free(resp);
@@ -77,32 +397,9 @@ static int ask_questions(pam_handle_t *pamh, config_t *config) {
     }
 
     // Fallthrough when all attempts are exhausted.
-    free(question);
-    char *correct_answer = get_answer(answer_state);
-    free_answer(answer_state);
-
-    char *msg_error =
-        d0_asprintf("Incorrect. Correct would have been: %s. Login failed.",
-                    correct_answer);
-    free(correct_answer);
-
-    struct pam_message msg;
-    const struct pam_message *pmsg = &msg;
-    msg.msg_style = PAM_ERROR_MSG;
-    msg.msg = msg_error;
-    struct pam_response *resp = NULL;
-    retval = conv->conv(1, &pmsg, &resp, conv->appdata_ptr);
-    free(msg_error);
-    if (retval != PAM_SUCCESS && retval != PAM_CONV_AGAIN) {
-      return retval;
-    }
-    free(resp[0].resp);
-    free(resp);
-    return PAM_AUTH_ERR;
+    return tell_answers(conv, state, &state->index, 1);
 
-  correct_answer:
-    free(question);
-    free_answer(answer_state);
+  correct_answer:;
   }
 
   return PAM_SUCCESS;
@@ -139,24 +436,35 @@ PAM_EXTERN int pam_sm_authenticate(pam_handle_t *pamh,
 PAM_EXTERN int pam_sm_authenticate(pam_handle_t *pamh,
                                    int flags __attribute__((unused)), int argc,
                                    const char **argv) {
-  int retval;
-  const char *user;
-
-  maybe_init_random();
+  handle_state_t *state = get_handle_state(pamh);
+  if (state == NULL) {
+    return PAM_SERVICE_ERR;
+  }
 
-  retval = pam_get_user(pamh, &user, "Username: ");
-  if (retval != PAM_SUCCESS) {
-    fprintf(stderr, "ERROR: could not query username: %s\n",
-            pam_strerror(pamh, retval));
-    return retval;
+  if (state->config_entry == NULL) {
+    // Whether stats are wanted is only known once the config is, so the
+    // phases before that are always timed.
+    memset(&state->stats_buf, 0, sizeof(state->stats_buf));
+    long long start = stats_start(&state->stats_buf);
+    const char *user;
+    int retval = pam_get_user(pamh, &user, "Username: ");
+    if (retval != PAM_SUCCESS) {
+      fprintf(stderr, "ERROR: could not query username: %s\n",
+              pam_strerror(pamh, retval));
+      return retval;
+    }
+    stats_add(&state->stats_buf, STATS_GET_USER, start, 1);
+    retval = start_conversation(state, user, argc, argv);
+    if (retval != PAM_SUCCESS) {
+      return retval;
+    }
   }
 
-  config_t *config = build_config(user, argc, argv);
-  if (config == NULL) {
-    fprintf(stderr, "ERROR: could not get config\n");
-    return PAM_SERVICE_ERR;
+  int result = ask_questions(pamh, state);
+  if (result == PAM_INCOMPLETE) {
+    COUNTERS_ADD(state->counters, conv_again, 1);
+  } else {
+    end_conversation(pamh, state);
   }
-  int result = ask_questions(pamh, config);
-  free_config(config);
   return result;
 }
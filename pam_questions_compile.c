@@ -0,0 +1,338 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>  // for uint64_t, uint32_t
+#include <stdio.h>   // for fprintf, stderr, fwrite, fopen, fclose, perror
+#include <stdlib.h>  // for free, calloc, malloc, realloc, qsort
+#include <string.h>  // for memcpy, memset, strlen, memchr, memcmp
+#include <strings.h> // for strncasecmp
+
+#include "alias.h"   // for alias_build, alias_t
+#include "bank.h"    // for bank_header, bank_group, bank_row, BANK_MAGIC
+#include "csv.h"     // for csv_span, csv_read_span, csv_span_weight, ...
+#include "helpers.h" // for d0_asprintf, hash_bytes
+
+// Interned strings, i.e. the string table of the bank.
+typedef struct {
+  char *data;
+  uint64_t size;
+  uint64_t capacity;
+  uint64_t *slots; // Offset + 1 of each string, or 0 if free.
+  uint64_t num_slots;
+  uint64_t used_slots;
+} strings_t;
+
+typedef struct {
+  uint64_t question;
+  uint64_t answer;
+  uint64_t match;
+  uint64_t line;
+  double weight;
+} row_t;
+
+static int strings_grow_slots(strings_t *strings) {
+  uint64_t num_slots = strings->num_slots ? strings->num_slots * 2 : 1024;
+  uint64_t *slots = calloc(num_slots, sizeof(*slots));
+  if (slots == NULL) {
+    fprintf(stderr, "ERROR: could not allocate string table\n");
+    return 0;
+  }
+  for (uint64_t i = 0; i < strings->num_slots; ++i) {
+    uint64_t entry = strings->slots[i];
+    if (entry == 0) {
+      continue;
+    }
+    const char *s = strings->data + entry - 1;
+    uint64_t j = hash_bytes(s, strlen(s)) & (num_slots - 1);
+    while (slots[j] != 0) {
+      j = (j + 1) & (num_slots - 1);
+    }
+    slots[j] = entry;
+  }
+  free(strings->slots);
+  strings->slots = slots;
+  strings->num_slots = num_slots;
+  return 1;
+}
+
+// Adds a string to the table unless already there, and returns its offset.
+static int intern(strings_t *strings, csv_span span, uint64_t *offset) {
+  // Like everywhere else, strings end at the first NUL.
+  const char *nul = memchr(span.ptr, 0, span.len);
+  if (nul != NULL) {
+    span.len = nul - span.ptr;
+  }
+  if ((strings->used_slots + 1) * 2 > strings->num_slots &&
+      !strings_grow_slots(strings)) {
+    return 0;
+  }
+  uint64_t j = hash_bytes(span.ptr, span.len) & (strings->num_slots - 1);
+  for (; strings->slots[j] != 0; j = (j + 1) & (strings->num_slots - 1)) {
+    const char *s = strings->data + strings->slots[j] - 1;
+    if (!memcmp(s, span.ptr, span.len) && s[span.len] == 0) {
+      *offset = strings->slots[j] - 1;
+      return 1;
+    }
+  }
+  if (strings->capacity - strings->size < span.len + 1) {
+    uint64_t capacity = strings->capacity ? strings->capacity : 65536;
+    while (capacity - strings->size < span.len + 1) {
+      capacity *= 2;
+    }
+    char *data = realloc(strings->data, capacity);
+    if (data == NULL) {
+      fprintf(stderr, "ERROR: could not allocate string table\n");
+      return 0;
+    }
+    strings->data = data;
+    strings->capacity = capacity;
+  }
+  *offset = strings->size;
+  memcpy(strings->data + strings->size, span.ptr, span.len);
+  strings->data[strings->size + span.len] = 0;
+  strings->size += span.len + 1;
+  strings->slots[j] = *offset + 1;
+  ++strings->used_slots;
+  return 1;
+}
+
+static int span_is(csv_span span, const char *name) {
+  return span.len == strlen(name) && !strncasecmp(span.ptr, name, span.len);
+}
+
+static int compare_rows(const void *a, const void *b) {
+  const row_t *ra = a, *rb = b;
+  if (ra->match != rb->match) {
+    return (ra->match < rb->match) ? -1 : 1;
+  }
+  return (ra->line < rb->line) ? -1 : (ra->line > rb->line);
+}
+
+static uint64_t align(uint64_t pos) {
+  return (pos + sizeof(uint64_t) - 1) & ~(uint64_t)(sizeof(uint64_t) - 1);
+}
+
+static int write_padded(FILE *out, const void *data, uint64_t size,
+                        uint64_t *pos) {
+  static const char zeros[sizeof(uint64_t)];
+  if (size != 0 && fwrite(data, size, 1, out) != 1) {
+    return 0;
+  }
+  *pos += size;
+  uint64_t padding = (sizeof(uint64_t) - *pos % sizeof(uint64_t)) %
+                     sizeof(uint64_t);
+  if (padding != 0 && fwrite(zeros, padding, 1, out) != 1) {
+    return 0;
+  }
+  *pos += padding;
+  return 1;
+}
+
+static int compile(const char *in_name, const char *out_name) {
+  csv_file file;
+  if (!csv_open(in_name, &file)) {
+    return 0;
+  }
+  char *pos = file.data;
+  char *end = file.data + file.size;
+
+  int match_col = -1, question_col = -1, answer_col = -1, weight_col = -1;
+  csv_buf csvbuf;
+  pos = csv_start(pos, end, &csvbuf);
+  csv_span value;
+  for (int col = 0; csv_read_span(&csvbuf, &value); ++col) {
+    if (span_is(value, "match")) {
+      match_col = col;
+    } else if (span_is(value, "question")) {
+      question_col = col;
+    } else if (span_is(value, "answer")) {
+      answer_col = col;
+    } else if (span_is(value, "weight")) {
+      weight_col = col;
+    }
+  }
+  if (question_col == -1 || answer_col == -1) {
+    fprintf(stderr, "ERROR: no column named question or answer found\n");
+    csv_close(&file);
+    return 0;
+  }
+
+  strings_t strings;
+  memset(&strings, 0, sizeof(strings));
+  row_t *rows = NULL;
+  uint64_t num_rows = 0, rows_capacity = 0;
+  int ok = 1;
+  uint64_t empty;
+  csv_span empty_span = {"", 0};
+  if (!intern(&strings, empty_span, &empty)) {
+    ok = 0;
+  }
+  int line = 1;
+  while (ok && pos != end) {
+    ++line;
+    row_t row;
+    row.match = empty;
+    row.line = line;
+    row.weight = 1;
+    int have_question = 0, have_answer = 0, bad_weight = 0;
+    pos = csv_start(pos, end, &csvbuf);
+    for (int col = 0; ok && csv_read_span(&csvbuf, &value); ++col) {
+      if (col == match_col) {
+        ok = intern(&strings, value, &row.match);
+      } else if (col == question_col) {
+        ok = intern(&strings, value, &row.question);
+        have_question = 1;
+      } else if (col == answer_col) {
+        ok = intern(&strings, value, &row.answer);
+        have_answer = 1;
+      } else if (col == weight_col) {
+        bad_weight = !csv_span_weight(value, &row.weight);
+      }
+    }
+    if (!have_question || !have_answer) {
+      fprintf(stderr,
+              "WARNING: no question or answer in line found in line %d\n",
+              line);
+      continue;
+    }
+    if (bad_weight) {
+      fprintf(stderr, "WARNING: invalid weight found in line %d\n", line);
+      continue;
+    }
+    if (num_rows == rows_capacity) {
+      rows_capacity = rows_capacity ? rows_capacity * 2 : 1024;
+      row_t *new_rows = realloc(rows, rows_capacity * sizeof(*rows));
+      if (new_rows == NULL) {
+        fprintf(stderr, "ERROR: could not allocate rows\n");
+        ok = 0;
+        break;
+      }
+      rows = new_rows;
+    }
+    rows[num_rows++] = row;
+  }
+  csv_close(&file);
+  if (ok && num_rows > UINT32_MAX) {
+    fprintf(stderr, "ERROR: too many questions\n");
+    ok = 0;
+  }
+
+  // Group the rows by match value. As match values are interned, their
+  // offsets identify them.
+  bank_group *groups = NULL;
+  uint32_t num_groups = 0;
+  bank_row *bank_rows = NULL;
+  int weighted = weight_col != -1;
+  double *weights = NULL, *group_weights = NULL;
+  alias_t *alias = NULL;
+  if (ok) {
+    qsort(rows, num_rows, sizeof(*rows), compare_rows);
+    groups = malloc((num_rows ? num_rows : 1) * sizeof(*groups));
+    bank_rows = malloc((num_rows ? num_rows : 1) * sizeof(*bank_rows));
+    if (weighted) {
+      weights = malloc((num_rows ? num_rows : 1) * sizeof(*weights));
+      group_weights = calloc(num_rows ? num_rows : 1, sizeof(*group_weights));
+      alias = malloc((num_rows ? num_rows : 1) * sizeof(*alias));
+    }
+    if (groups == NULL || bank_rows == NULL ||
+        (weighted &&
+         (weights == NULL || group_weights == NULL || alias == NULL))) {
+      fprintf(stderr, "ERROR: could not allocate groups\n");
+      ok = 0;
+    }
+  }
+  if (ok) {
+    for (uint64_t i = 0; i < num_rows; ++i) {
+      if (i == 0 || rows[i].match != rows[i - 1].match) {
+        groups[num_groups].match = rows[i].match;
+        groups[num_groups].first_row = i;
+        groups[num_groups].num_rows = 0;
+        ++num_groups;
+      }
+      ++groups[num_groups - 1].num_rows;
+      bank_rows[i].question = rows[i].question;
+      bank_rows[i].answer = rows[i].answer;
+      if (weighted) {
+        weights[i] = rows[i].weight;
+        group_weights[num_groups - 1] += rows[i].weight;
+      }
+    }
+    for (uint32_t g = 0; weighted && ok && g < num_groups; ++g) {
+      ok = alias_build(weights + groups[g].first_row, groups[g].num_rows,
+                       alias + groups[g].first_row);
+    }
+  }
+
+  // Write to a temporary file first, so that readers never see a partial
+  // bank.
+  char *tmp_name = ok ? d0_asprintf("%s.tmp", out_name) : NULL;
+  FILE *out = (tmp_name != NULL) ? fopen(tmp_name, "wb") : NULL;
+  if (ok && out == NULL) {
+    perror("ERROR: could not create bank");
+    ok = 0;
+  }
+  if (ok) {
+    bank_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BANK_MAGIC, sizeof(header.magic));
+    header.version = BANK_VERSION;
+    header.byte_order = BANK_BYTE_ORDER;
+    header.num_groups = num_groups;
+    header.num_rows = num_rows;
+    header.groups_offset = align(sizeof(header));
+    header.rows_offset =
+        align(header.groups_offset + num_groups * sizeof(*groups));
+    header.strings_offset =
+        align(header.rows_offset + num_rows * sizeof(*bank_rows));
+    header.strings_size = strings.size;
+    if (weighted) {
+      header.flags = BANK_WEIGHTED;
+      header.group_weights_offset =
+          align(header.strings_offset + strings.size);
+      header.alias_offset = align(header.group_weights_offset +
+                                  num_groups * sizeof(*group_weights));
+    }
+    uint64_t out_pos = 0;
+    ok = write_padded(out, &header, sizeof(header), &out_pos) &&
+         write_padded(out, groups, num_groups * sizeof(*groups), &out_pos) &&
+         write_padded(out, bank_rows, num_rows * sizeof(*bank_rows),
+                      &out_pos) &&
+         write_padded(out, strings.data, strings.size, &out_pos) &&
+         (!weighted ||
+          (write_padded(out, group_weights,
+                        num_groups * sizeof(*group_weights), &out_pos) &&
+           write_padded(out, alias, num_rows * sizeof(*alias), &out_pos)));
+    if (fclose(out) != 0) {
+      ok = 0;
+    }
+    if (!ok) {
+      perror("ERROR: could not write bank");
+      remove(tmp_name);
+    } else if (rename(tmp_name, out_name) != 0) {
+      perror("ERROR: could not rename bank");
+      remove(tmp_name);
+      ok = 0;
+    } else {
+      fprintf(stderr, "Compiled %lu questions in %lu groups.\n",
+              (unsigned long)num_rows, (unsigned long)num_groups);
+    }
+  }
+
+  free(tmp_name);
+  free(alias);
+  free(group_weights);
+  free(weights);
+  free(bank_rows);
+  free(groups);
+  free(rows);
+  free(strings.slots);
+  free(strings.data);
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  if (argc != 3) {
+    fprintf(stderr, "Usage: %s questions.csv questions.bank\n", argv[0]);
+    return 1;
+  }
+  return compile(argv[1], argv[2]) ? 0 : 1;
+}
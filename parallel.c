@@ -0,0 +1,68 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "parallel.h"
+
+#include <pthread.h> // for pthread_mutex_lock, pthread_mutex_unlock, ...
+
+typedef struct {
+  void (*fn)(void *ctx, int task, int worker);
+  void *ctx;
+  int num_tasks;
+  int next_task;
+  pthread_mutex_t lock;
+} work_t;
+
+typedef struct {
+  work_t *work;
+  int worker;
+} worker_t;
+
+static void *run_worker(void *arg) {
+  worker_t *worker = arg;
+  work_t *work = worker->work;
+  for (;;) {
+    pthread_mutex_lock(&work->lock);
+    int task = work->next_task++;
+    pthread_mutex_unlock(&work->lock);
+    if (task >= work->num_tasks) {
+      break;
+    }
+    work->fn(work->ctx, task, worker->worker);
+  }
+  return NULL;
+}
+
+void parallel_for(int threads, int num_tasks,
+                  void (*fn)(void *ctx, int task, int worker), void *ctx) {
+  work_t work;
+  work.fn = fn;
+  work.ctx = ctx;
+  work.num_tasks = num_tasks;
+  work.next_task = 0;
+  pthread_mutex_init(&work.lock, NULL);
+  if (threads > THREADS_MAX) {
+    threads = THREADS_MAX;
+  }
+  if (threads > num_tasks) {
+    threads = num_tasks;
+  }
+  pthread_t thread_ids[THREADS_MAX];
+  worker_t workers[THREADS_MAX];
+  int num_threads = 1;
+  for (; num_threads < threads; ++num_threads) {
+    workers[num_threads].work = &work;
+    workers[num_threads].worker = num_threads;
+    if (pthread_create(&thread_ids[num_threads], NULL, run_worker,
+                       &workers[num_threads]) != 0) {
+      // Just use fewer threads.
+      break;
+    }
+  }
+  workers[0].work = &work;
+  workers[0].worker = 0;
+  run_worker(&workers[0]);
+  for (int i = 1; i < num_threads; ++i) {
+    pthread_join(thread_ids[i], NULL);
+  }
+  pthread_mutex_destroy(&work.lock);
+}
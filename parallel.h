@@ -0,0 +1,15 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#define THREADS_MAX 16
+
+// Calls fn(ctx, task, worker) for every task in [0, num_tasks) on up to
+// threads threads (at most THREADS_MAX), with worker being the index of the
+// thread in [0, threads). The calling thread works too, as worker 0.
+// Threads are started and joined on every call, as a module may be unloaded
+// and its process may fork between calls, so this is for loading files rather
+// than for work on every login.
+void parallel_for(int threads, int num_tasks,
+                  void (*fn)(void *ctx, int task, int worker), void *ctx);
+
+#endif
@@ -1,6 +1,14 @@
 #ifndef MATH_QUESTIONS_H
 #define MATH_QUESTIONS_H
 
+#include <stddef.h> // for size_t
+
+#include "arena.h"   // for arena_t
+#include "helpers.h" // for random_lanes_t, random_t
+
+// Name of the module, e.g. for keeping data on the PAM handle.
+extern const char module_name[];
+
 typedef struct config_s config_t;
 
 config_t *build_config(const char *user, int argc, const char **argv);
@@ -8,12 +16,45 @@ void free_config(config_t *config);
 
 int num_questions(config_t *config);
 int num_attempts(config_t *config);
+// Whether to ask all questions in a single conversation call.
+int batch_prompts(config_t *config);
+// Whether to time the phases of authentications and log them.
+int collect_stats(config_t *config);
+// The file to keep counters in, shared between processes, or NULL.
+const char *counters_file(config_t *config);
 
 typedef struct answer_state_s answer_state_t;
 
-char *make_question(config_t *config, answer_state_t **answer_state);
+// Questions are made using the random numbers of the given stream only, so
+// that authentications can run in parallel. They and their answer states are
+// allocated from the arena, and live as long as it does.
+char *make_question(config_t *config, random_t *rng, arena_t *arena,
+                    answer_state_t **answer_state);
+// Makes n questions at once. pam_questions_file avoids repeats where
+// possible; pam_math draws each question independently. Returns 0 on failure.
+int make_questions(config_t *config, random_t *rng, arena_t *arena, int n,
+                   char **questions, answer_state_t **answer_states);
+
+// A question made by make_question_records, with its expected answer.
+typedef struct {
+  char *question;
+  char *answer;
+} question_record_t;
+
+// Makes n questions like make_questions, but without allocating for each:
+// their text is stored in buf, which holds size bytes. For pregenerating
+// questions and load tests. pam_math draws some of the numbers from lanes,
+// which the caller forks from rng once with random_lanes_fork and keeps
+// across calls. Returns the number of records made, which is less than n if
+// buf is full, or 0 on failure.
+int make_question_records(config_t *config, random_t *rng,
+                          random_lanes_t *lanes, int n,
+                          question_record_t *records, char *buf, size_t size);
+
 int check_answer(answer_state_t *answer_state, const char *given);
-char *get_answer(answer_state_t *answer_state);
-void free_answer(answer_state_t *answer_state);
+const char *get_answer(answer_state_t *answer_state);
+// The kind of question, counted separately, e.g. the op. Less than
+// COUNTERS_KINDS.
+int answer_kind(answer_state_t *answer_state);
 
 #endif
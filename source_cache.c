@@ -0,0 +1,717 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "source_cache.h"
+
+#include <dirent.h>   // for closedir, opendir, readdir, DIR, dirent
+#include <fcntl.h>    // for open, O_RDONLY
+#include <limits.h>   // for INT_MAX
+#include <pthread.h>  // for pthread_mutex_lock, pthread_mutex_unlock, ...
+#include <stdio.h>    // for fprintf, stderr, perror, NULL
+#include <stdlib.h>   // for free, calloc, malloc, realloc, qsort
+#include <string.h>   // for memchr, memcmp, memcpy, strcmp, strlen, strrchr
+#include <strings.h>  // for strncasecmp
+#include <sys/stat.h> // for stat, S_ISDIR
+#include <unistd.h>   // for getpid, close, read, ssize_t
+
+#ifdef __linux__
+#include <sys/inotify.h> // for inotify_add_watch, inotify_init1, inotify_...
+#endif
+
+#include "alias.h"    // for alias_build
+#include "helpers.h"  // for d0_asprintf, d0_strndup, hash_bytes
+#include "parallel.h" // for parallel_for
+
+// Files larger than this are split into parts parsed in parallel.
+#define PART_SIZE (1 << 20)
+
+// All loaded sources. Entries are replaced, never modified.
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static source_t **cache;
+static int cache_size;
+
+#ifdef __linux__
+#define WATCH_EVENTS                                                           \
+  (IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_DELETE_SELF |       \
+   IN_MODIFY | IN_MOVE_SELF | IN_MOVED_FROM | IN_MOVED_TO)
+
+// inotify instance telling which sources changed, if available.
+static int watch_fd = -1;
+static pid_t watch_pid;
+#endif
+
+static void free_source(source_t *source) {
+  for (int i = 0; i < source->num_names; ++i) {
+    free(source->names[i]);
+  }
+  free(source->names);
+  if (source->file.data != NULL) {
+    csv_close(&source->file);
+  }
+  free(source->alias);
+  free(source->rows);
+  free(source->groups);
+  for (int i = 0; i < source->num_pools; ++i) {
+    free(source->pools[i]);
+  }
+  free(source->pools);
+  free(source->name);
+  free(source);
+}
+
+static void release_locked(source_t *source) {
+  if (--source->refs == 0) {
+    free_source(source);
+  }
+}
+
+#ifdef __linux__
+// Marks all sources affected by pending inotify events as stale.
+static void process_watch_events(void) {
+  char buf[4096]
+      __attribute__((aligned(__alignof__(struct inotify_event))));
+  for (;;) {
+    ssize_t n = read(watch_fd, buf, sizeof(buf));
+    if (n <= 0) {
+      break;
+    }
+    const char *p = buf;
+    while (p < buf + n) {
+      const struct inotify_event *event = (const struct inotify_event *)p;
+      for (int i = 0; i < cache_size; ++i) {
+        source_t *source = cache[i];
+        // Events without a name are about the watched directory itself.
+        if ((event->mask & IN_Q_OVERFLOW) ||
+            (source->watch == event->wd &&
+             (source->basename == NULL || event->len == 0 ||
+              !strcmp(event->name, source->basename)))) {
+          source->stale = 1;
+        }
+      }
+      p += sizeof(struct inotify_event) + event->len;
+    }
+  }
+}
+
+static void start_watching_locked(void) {
+  if (watch_fd >= 0 && watch_pid == getpid()) {
+    return;
+  }
+  // A forked child must not steal the events of its parent.
+  if (watch_fd >= 0) {
+    close(watch_fd);
+    for (int i = 0; i < cache_size; ++i) {
+      cache[i]->stale = 1;
+    }
+  }
+  watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  watch_pid = getpid();
+}
+#endif
+
+// Returns whether a cached source is still current.
+static int unchanged_locked(source_t *source) {
+  if (source->stale) {
+    return 0;
+  }
+#ifdef __linux__
+  if (watch_fd >= 0 && source->watch >= 0) {
+    return 1;
+  }
+#endif
+  struct stat st;
+  return stat(source->name, &st) == 0 && st.st_dev == source->dev &&
+         st.st_ino == source->ino && st.st_size == source->size &&
+         st.st_mtim.tv_sec == source->mtime.tv_sec &&
+         st.st_mtim.tv_nsec == source->mtime.tv_nsec;
+}
+
+static void watch_source(source_t *source) {
+  source->watch = -1;
+  const char *slash = strrchr(source->name, '/');
+  source->basename = source->is_dir ? NULL : slash ? slash + 1 : source->name;
+#ifdef __linux__
+  if (watch_fd < 0) {
+    return;
+  }
+  char *dir;
+  if (source->is_dir) {
+    dir = d0_strndup(source->name, strlen(source->name));
+  } else if (slash == NULL) {
+    dir = d0_strndup(".", 1);
+  } else {
+    // Keep the / if it is the only one.
+    dir = d0_strndup(source->name,
+                     (slash == source->name) ? 1 : slash - source->name);
+  }
+  if (dir == NULL) {
+    return;
+  }
+  source->watch = inotify_add_watch(watch_fd, dir, WATCH_EVENTS);
+  free(dir);
+#endif
+}
+
+static int compare_names(const void *a, const void *b) {
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static int has_suffix(const char *s, size_t len, const char *suffix) {
+  size_t suffix_len = strlen(suffix);
+  return len >= suffix_len && !strcmp(s + len - suffix_len, suffix);
+}
+
+// Lists all *.csv and *.bank files in a directory, in a stable order.
+static int load_directory(source_t *source) {
+  DIR *dir = opendir(source->name);
+  if (dir == NULL) {
+    perror("ERROR: could not open questions directory");
+    return 0;
+  }
+  int ok = 1;
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    size_t len = strlen(entry->d_name);
+    if (entry->d_name[0] == '.' || (!has_suffix(entry->d_name, len, ".csv") &&
+                                    !has_suffix(entry->d_name, len, ".bank"))) {
+      continue;
+    }
+    char **names =
+        realloc(source->names, (source->num_names + 1) * sizeof(*names));
+    if (names == NULL) {
+      fprintf(stderr, "ERROR: could not allocate file names\n");
+      ok = 0;
+      break;
+    }
+    source->names = names;
+    names[source->num_names] =
+        d0_asprintf("%s/%s", source->name, entry->d_name);
+    if (names[source->num_names] == NULL) {
+      ok = 0;
+      break;
+    }
+    ++source->num_names;
+  }
+  closedir(dir);
+  if (source->num_names == 0) {
+    return ok;
+  }
+  qsort(source->names, source->num_names, sizeof(*source->names),
+        compare_names);
+  return ok;
+}
+
+// A row while parsing, with offsets into the pool of its part.
+typedef struct {
+  int key;
+  size_t question;
+  size_t answer;
+  double weight;
+} part_row_t;
+
+// A line aligned part of a CSV file while parsing.
+typedef struct {
+  char *begin;
+  char *end;
+  char *pool;
+  size_t pool_size;
+  size_t pool_capacity;
+  part_row_t *rows;
+  int num_rows;
+  int rows_capacity;
+  // The distinct match values, as pool offsets, and a hash table of them.
+  size_t *keys;
+  int num_keys;
+  int keys_capacity;
+  int *slots; // Key + 1, or 0 if free.
+  int num_slots;
+  int failed;
+} part_t;
+
+typedef struct {
+  source_t *source;
+  part_t *parts;
+  int match_col, question_col, answer_col, weight_col, last_col;
+} parse_t;
+
+static int span_is(csv_span span, const char *name) {
+  return span.len == strlen(name) && !strncasecmp(span.ptr, name, span.len);
+}
+
+// Like everywhere else, strings end at the first NUL.
+static csv_span truncate_at_nul(csv_span span) {
+  const char *nul = memchr(span.ptr, 0, span.len);
+  if (nul != NULL) {
+    span.len = nul - span.ptr;
+  }
+  return span;
+}
+
+// Appends a string to the pool of a part.
+static int pool_add(part_t *part, csv_span span, size_t *offset) {
+  span = truncate_at_nul(span);
+  if (part->pool_capacity - part->pool_size < span.len + 1) {
+    size_t new_capacity = part->pool_capacity ? part->pool_capacity : 4096;
+    while (new_capacity - part->pool_size < span.len + 1) {
+      new_capacity *= 2;
+    }
+    char *pool = realloc(part->pool, new_capacity);
+    if (pool == NULL) {
+      fprintf(stderr, "ERROR: could not allocate %d bytes\n",
+              (int)new_capacity);
+      return 0;
+    }
+    part->pool = pool;
+    part->pool_capacity = new_capacity;
+  }
+  *offset = part->pool_size;
+  memcpy(part->pool + part->pool_size, span.ptr, span.len);
+  part->pool[part->pool_size + span.len] = 0;
+  part->pool_size += span.len + 1;
+  return 1;
+}
+
+static int grow_key_slots(part_t *part) {
+  int num_slots = part->num_slots ? part->num_slots * 2 : 64;
+  int *slots = calloc(num_slots, sizeof(*slots));
+  if (slots == NULL) {
+    fprintf(stderr, "ERROR: could not allocate match values\n");
+    return 0;
+  }
+  for (int k = 0; k < part->num_keys; ++k) {
+    const char *key = part->pool + part->keys[k];
+    int j = hash_bytes(key, strlen(key)) & (num_slots - 1);
+    while (slots[j] != 0) {
+      j = (j + 1) & (num_slots - 1);
+    }
+    slots[j] = k + 1;
+  }
+  free(part->slots);
+  part->slots = slots;
+  part->num_slots = num_slots;
+  return 1;
+}
+
+// Looks up a match value among the keys of a part, adding it if new.
+static int intern_key(part_t *part, csv_span span, int *key) {
+  span = truncate_at_nul(span);
+  if ((part->num_keys + 1) * 2 > part->num_slots && !grow_key_slots(part)) {
+    return 0;
+  }
+  int j = hash_bytes(span.ptr, span.len) & (part->num_slots - 1);
+  for (; part->slots[j] != 0; j = (j + 1) & (part->num_slots - 1)) {
+    const char *s = part->pool + part->keys[part->slots[j] - 1];
+    if (!memcmp(s, span.ptr, span.len) && s[span.len] == 0) {
+      *key = part->slots[j] - 1;
+      return 1;
+    }
+  }
+  if (part->num_keys == part->keys_capacity) {
+    int capacity = part->keys_capacity ? part->keys_capacity * 2 : 32;
+    size_t *keys = realloc(part->keys, capacity * sizeof(*keys));
+    if (keys == NULL) {
+      fprintf(stderr, "ERROR: could not allocate match values\n");
+      return 0;
+    }
+    part->keys = keys;
+    part->keys_capacity = capacity;
+  }
+  if (!pool_add(part, span, &part->keys[part->num_keys])) {
+    return 0;
+  }
+  *key = part->num_keys++;
+  part->slots[j] = *key + 1;
+  return 1;
+}
+
+static void parse_part(void *ctx, int task, int worker) {
+  (void)worker;
+  parse_t *parse = ctx;
+  source_t *source = parse->source;
+  part_t *part = &parse->parts[task];
+  char *pos = part->begin;
+  // The empty string, for rows without a match column.
+  csv_span empty = {"", 0};
+  int empty_key;
+  if (!intern_key(part, empty, &empty_key)) {
+    part->failed = 1;
+    return;
+  }
+  while (pos != part->end) {
+    part_row_t row;
+    row.key = empty_key;
+    row.weight = 1;
+    int have_question = 0, have_answer = 0, bad_weight = 0;
+    csv_buf csvbuf;
+    char *line = pos;
+    pos = csv_start(pos, part->end, &csvbuf);
+    for (int col = 0; col <= parse->last_col; ++col) {
+      if (col != parse->match_col && col != parse->question_col &&
+          col != parse->answer_col && col != parse->weight_col) {
+        if (!csv_skip(&csvbuf)) {
+          break;
+        }
+        continue;
+      }
+      csv_span value;
+      int ok;
+      if (!csv_read_span(&csvbuf, &value)) {
+        break;
+      } else if (col == parse->match_col) {
+        ok = intern_key(part, value, &row.key);
+      } else if (col == parse->weight_col) {
+        ok = 1;
+        bad_weight = !csv_span_weight(value, &row.weight);
+      } else if (col == parse->question_col) {
+        ok = pool_add(part, value, &row.question);
+        have_question = 1;
+      } else {
+        ok = pool_add(part, value, &row.answer);
+        have_answer = 1;
+      }
+      if (!ok) {
+        part->failed = 1;
+        return;
+      }
+    }
+    if (!have_question || !have_answer) {
+      fprintf(stderr,
+              "WARNING: no question or answer found in %s at offset %ld\n",
+              source->name, (long)(line - source->file.data));
+      continue;
+    }
+    if (bad_weight) {
+      fprintf(stderr, "WARNING: invalid weight found in %s at offset %ld\n",
+              source->name, (long)(line - source->file.data));
+      continue;
+    }
+    if (part->num_rows == part->rows_capacity) {
+      int capacity = part->rows_capacity ? part->rows_capacity * 2 : 256;
+      part_row_t *rows = realloc(part->rows, capacity * sizeof(*rows));
+      if (rows == NULL) {
+        fprintf(stderr, "ERROR: could not allocate rows\n");
+        part->failed = 1;
+        return;
+      }
+      part->rows = rows;
+      part->rows_capacity = capacity;
+    }
+    part->rows[part->num_rows++] = row;
+  }
+}
+
+// Merges the keys of all parts into groups of rows by match value, keeping
+// the rows of each group in file order. Moves the pools to the source.
+static int group_rows(source_t *source, part_t *parts, int num_parts) {
+  int total_keys = 0;
+  long total_rows = 0;
+  for (int i = 0; i < num_parts; ++i) {
+    total_keys += parts[i].num_keys;
+    total_rows += parts[i].num_rows;
+  }
+  if (total_rows > INT_MAX) {
+    fprintf(stderr, "ERROR: too many questions in %s\n", source->name);
+    return 0;
+  }
+  int num_slots = 64;
+  while (num_slots < total_keys * 2) {
+    num_slots *= 2;
+  }
+  int *slots = calloc(num_slots, sizeof(*slots)); // Group + 1, or 0 if free.
+  // Allocate at least one element each, as malloc(0) may return NULL.
+  int *key_groups = malloc((total_keys + 1) * sizeof(*key_groups));
+  source->groups = malloc((total_keys + 1) * sizeof(*source->groups));
+  source->rows = malloc((total_rows + 1) * sizeof(*source->rows));
+  source->pools = malloc((num_parts + 1) * sizeof(*source->pools));
+  double *weights = NULL;
+  if (source->weighted) {
+    weights = malloc((total_rows + 1) * sizeof(*weights));
+    source->alias = malloc((total_rows + 1) * sizeof(*source->alias));
+  }
+  if (slots == NULL || key_groups == NULL || source->groups == NULL ||
+      source->rows == NULL || source->pools == NULL ||
+      (source->weighted && (weights == NULL || source->alias == NULL))) {
+    fprintf(stderr, "ERROR: could not allocate groups\n");
+    free(weights);
+    free(key_groups);
+    free(slots);
+    return 0;
+  }
+
+  // Assign a group to every key, and count the rows of each group.
+  int *key_group = key_groups;
+  for (int i = 0; i < num_parts; ++i) {
+    part_t *part = &parts[i];
+    for (int k = 0; k < part->num_keys; ++k) {
+      const char *match = part->pool + part->keys[k];
+      int j = hash_bytes(match, strlen(match)) & (num_slots - 1);
+      while (slots[j] != 0 &&
+             strcmp(source->groups[slots[j] - 1].match, match)) {
+        j = (j + 1) & (num_slots - 1);
+      }
+      if (slots[j] == 0) {
+        source_group_t *group = &source->groups[source->num_groups];
+        group->match = match;
+        group->num_rows = 0;
+        group->weight = 0;
+        slots[j] = ++source->num_groups;
+      }
+      key_group[k] = slots[j] - 1;
+    }
+    for (int r = 0; r < part->num_rows; ++r) {
+      source_group_t *group = &source->groups[key_group[part->rows[r].key]];
+      ++group->num_rows;
+      group->weight += part->rows[r].weight;
+    }
+    key_group += part->num_keys;
+  }
+
+  // Lay out the groups one after another, and fill in their rows.
+  int first_row = 0;
+  for (int g = 0; g < source->num_groups; ++g) {
+    source->groups[g].first_row = first_row;
+    first_row += source->groups[g].num_rows;
+    source->groups[g].num_rows = 0;
+  }
+  key_group = key_groups;
+  for (int i = 0; i < num_parts; ++i) {
+    part_t *part = &parts[i];
+    for (int r = 0; r < part->num_rows; ++r) {
+      const part_row_t *row = &part->rows[r];
+      source_group_t *group = &source->groups[key_group[row->key]];
+      int index = group->first_row + group->num_rows++;
+      source->rows[index].question = part->pool + row->question;
+      source->rows[index].answer = part->pool + row->answer;
+      if (weights != NULL) {
+        weights[index] = row->weight;
+      }
+    }
+    key_group += part->num_keys;
+    source->pools[source->num_pools++] = part->pool;
+    part->pool = NULL;
+  }
+  source->num_rows = total_rows;
+
+  // Weighted rows are picked within their group by alias tables.
+  int ok = 1;
+  for (int g = 0; ok && weights != NULL && g < source->num_groups; ++g) {
+    const source_group_t *group = &source->groups[g];
+    ok = alias_build(weights + group->first_row, group->num_rows,
+                     source->alias + group->first_row);
+  }
+
+  free(weights);
+  free(key_groups);
+  free(slots);
+  return ok;
+}
+
+// Parses a CSV file in line aligned parts, on up to threads threads.
+static int load_csv(source_t *source, int threads) {
+  char *end = source->file.data + source->file.size;
+  parse_t parse;
+  parse.source = source;
+  parse.match_col = parse.question_col = parse.answer_col = -1;
+  parse.weight_col = -1;
+  csv_buf csvbuf;
+  char *body = csv_start(source->file.data, end, &csvbuf);
+  csv_span col_name;
+  for (int col = 0; csv_read_span(&csvbuf, &col_name); ++col) {
+    if (span_is(col_name, "match")) {
+      parse.match_col = col;
+    } else if (span_is(col_name, "question")) {
+      parse.question_col = col;
+    } else if (span_is(col_name, "answer")) {
+      parse.answer_col = col;
+    } else if (span_is(col_name, "weight")) {
+      parse.weight_col = col;
+    }
+  }
+  if (parse.question_col == -1 || parse.answer_col == -1) {
+    fprintf(stderr, "ERROR: no column named question or answer found in %s\n",
+            source->name);
+    return 0;
+  }
+  parse.last_col = (parse.match_col > parse.question_col) ? parse.match_col
+                                                          : parse.question_col;
+  if (parse.answer_col > parse.last_col) {
+    parse.last_col = parse.answer_col;
+  }
+  if (parse.weight_col > parse.last_col) {
+    parse.last_col = parse.weight_col;
+  }
+  source->weighted = parse.weight_col != -1;
+
+  int max_parts = (end - body) / PART_SIZE + 1;
+  parse.parts = calloc(max_parts, sizeof(*parse.parts));
+  if (parse.parts == NULL) {
+    fprintf(stderr, "ERROR: could not allocate parts\n");
+    return 0;
+  }
+  int num_parts = 0;
+  for (char *begin = body; begin != end; ++num_parts) {
+    parse.parts[num_parts].begin = begin;
+    if (end - begin > PART_SIZE) {
+      begin = csv_start(begin + PART_SIZE, end, &csvbuf);
+    } else {
+      begin = end;
+    }
+    parse.parts[num_parts].end = begin;
+  }
+  parallel_for(threads, num_parts, parse_part, &parse);
+  int ok = 1;
+  for (int i = 0; i < num_parts; ++i) {
+    if (parse.parts[i].failed) {
+      ok = 0;
+    }
+  }
+  if (ok) {
+    ok = group_rows(source, parse.parts, num_parts);
+  }
+  for (int i = 0; i < num_parts; ++i) {
+    free(parse.parts[i].slots);
+    free(parse.parts[i].keys);
+    free(parse.parts[i].rows);
+    free(parse.parts[i].pool);
+  }
+  free(parse.parts);
+  return ok;
+}
+
+// Returns whether a file starts like a compiled bank.
+static int is_bank_file(const char *name) {
+  int fd = open(name, O_RDONLY);
+  if (fd < 0) {
+    return 0;
+  }
+  char header[BANK_HEADER_V1_SIZE];
+  ssize_t n = read(fd, header, sizeof(header));
+  close(fd);
+  return n > 0 && bank_detect(header, n);
+}
+
+static source_t *load_source(const char *name, int threads) {
+  source_t *source = calloc(1, sizeof(*source));
+  if (source == NULL) {
+    fprintf(stderr, "ERROR: could not allocate source\n");
+    return NULL;
+  }
+  source->name = d0_strndup(name, strlen(name));
+  if (source->name == NULL) {
+    free(source);
+    return NULL;
+  }
+  source->refs = 1;
+  struct stat st;
+  if (stat(name, &st) != 0) {
+    perror("ERROR: could not find questions file");
+    free_source(source);
+    return NULL;
+  }
+  source->is_dir = S_ISDIR(st.st_mode);
+  // Watch before reading, so that no change gets lost.
+  watch_source(source);
+  if (stat(name, &st) != 0) {
+    perror("ERROR: could not find questions file");
+    free_source(source);
+    return NULL;
+  }
+  source->dev = st.st_dev;
+  source->ino = st.st_ino;
+  source->size = st.st_size;
+  source->mtime = st.st_mtim;
+
+  int ok;
+  if (source->is_dir) {
+    ok = load_directory(source);
+  } else if (is_bank_file(name)) {
+    // Read rather than mapped, as banks are used long after loading, and
+    // reading a mapping of a bank rewritten in place would crash on SIGBUS.
+    // They are small once compiled.
+    source->is_bank = 1;
+    if (!csv_read_file(name, &source->file)) {
+      source->file.data = NULL;
+      ok = 0;
+    } else {
+      ok = bank_load(source->file.data, source->file.size, &source->bank);
+    }
+  } else if (!csv_open(name, &source->file)) {
+    source->file.data = NULL;
+    ok = 0;
+  } else {
+    ok = load_csv(source, threads);
+    // All needed data got copied, so that the file may be changed in place
+    // without crashing.
+    csv_close(&source->file);
+    source->file.data = NULL;
+  }
+  if (!ok) {
+    fprintf(stderr, "ERROR: could not load %s\n", name);
+    free_source(source);
+    return NULL;
+  }
+  return source;
+}
+
+source_t *source_acquire(const char *name, int threads) {
+  pthread_mutex_lock(&cache_lock);
+#ifdef __linux__
+  start_watching_locked();
+  if (watch_fd >= 0) {
+    process_watch_events();
+  }
+#endif
+  int index = -1;
+  for (int i = 0; i < cache_size; ++i) {
+    if (!strcmp(cache[i]->name, name)) {
+      index = i;
+      break;
+    }
+  }
+  if (index >= 0 && unchanged_locked(cache[index])) {
+    source_t *source = cache[index];
+    ++source->refs;
+    pthread_mutex_unlock(&cache_lock);
+    return source;
+  }
+  pthread_mutex_unlock(&cache_lock);
+
+  // Load without holding the lock, so other authentications can go on with
+  // the previous version meanwhile.
+  source_t *source = load_source(name, threads);
+  if (source == NULL) {
+    return NULL;
+  }
+
+  // Swap it in. The previous version lives on until its last user releases
+  // it.
+  pthread_mutex_lock(&cache_lock);
+  ++source->refs;
+  index = -1;
+  for (int i = 0; i < cache_size; ++i) {
+    if (!strcmp(cache[i]->name, name)) {
+      index = i;
+      break;
+    }
+  }
+  if (index >= 0) {
+    release_locked(cache[index]);
+    cache[index] = source;
+  } else {
+    source_t **new_cache = realloc(cache, (cache_size + 1) * sizeof(*cache));
+    if (new_cache == NULL) {
+      // Just do not cache it.
+      --source->refs;
+    } else {
+      cache = new_cache;
+      cache[cache_size++] = source;
+    }
+  }
+  pthread_mutex_unlock(&cache_lock);
+  return source;
+}
+
+void source_release(source_t *source) {
+  pthread_mutex_lock(&cache_lock);
+  release_locked(source);
+  pthread_mutex_unlock(&cache_lock);
+}
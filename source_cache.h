@@ -0,0 +1,70 @@
+#ifndef SOURCE_CACHE_H
+#define SOURCE_CACHE_H
+
+#include <sys/types.h> // for dev_t, ino_t, off_t
+#include <time.h>      // for timespec
+
+#include "alias.h" // for alias_t
+#include "bank.h"  // for bank_t
+#include "csv.h"   // for csv_file
+
+// The rows of a CSV file sharing the same match value, like in a compiled
+// bank.
+typedef struct {
+  const char *match;
+  int first_row;
+  int num_rows;
+  double weight; // Sum of the weights of the rows.
+} source_group_t;
+
+typedef struct {
+  const char *question;
+  const char *answer;
+} source_row_t;
+
+// A questions file or directory, loaded into memory and shared between
+// authentications until it changes. Never modified once loaded.
+typedef struct source_s {
+  char *name;
+
+  // Directories: the *.csv and *.bank files within, sorted.
+  int is_dir;
+  char **names;
+  int num_names;
+
+  // Compiled banks: the mapped bank.
+  int is_bank;
+  csv_file file;
+  bank_t bank;
+
+  // CSV files: the rows grouped by match value, and the strings they point
+  // into.
+  source_group_t *groups;
+  int num_groups;
+  source_row_t *rows;
+  int num_rows;
+  // If there is a weight column: per row, the alias table of its group.
+  int weighted;
+  alias_t *alias;
+  char **pools;
+  int num_pools;
+
+  // Identity of the file as loaded, and cache bookkeeping.
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  struct timespec mtime;
+  const char *basename;
+  int watch;
+  int stale;
+  int refs;
+} source_t;
+
+// Returns the source of the given name, loading it (on up to threads threads)
+// if it is not in the cache or changed since. Returns NULL on failure.
+source_t *source_acquire(const char *name, int threads);
+
+// Releases a source returned by source_acquire.
+void source_release(source_t *source);
+
+#endif
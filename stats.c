@@ -0,0 +1,61 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "stats.h"
+
+#include <stdio.h> // for snprintf, NULL, size_t
+#include <time.h>  // for clock_gettime, timespec, CLOCK_MONOTONIC
+
+static const char *const phase_names[STATS_PHASES] = {
+    "pam_get_user", "build_config", "make_question",
+    "conv",         "check_answer", "free_config"};
+
+static long long now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+const char *stats_phase_name(int phase) { return phase_names[phase]; }
+
+long long stats_start(const stats_t *stats) {
+  return (stats == NULL) ? 0 : now_ns();
+}
+
+void stats_add(stats_t *stats, int phase, long long start, int n) {
+  if (stats == NULL || n <= 0) {
+    return;
+  }
+  long long ns = now_ns() - start;
+  stats->total_ns[phase] += ns;
+  long long each = ns / n;
+  int bucket = 0;
+  while (bucket < STATS_BUCKETS - 1 && each >= 2LL << bucket) {
+    ++bucket;
+  }
+  stats->buckets[phase][bucket] += n;
+}
+
+int stats_format(const stats_t *stats, int phase, char *buf, size_t size) {
+  long long count = 0;
+  for (int i = 0; i < STATS_BUCKETS; ++i) {
+    count += stats->buckets[phase][i];
+  }
+  if (count == 0) {
+    return 0;
+  }
+  int len = snprintf(buf, size, "%s: n=%lld total=%lldns histogram=",
+                     phase_names[phase], count, stats->total_ns[phase]);
+  const char *sep = "";
+  for (int i = 0; i < STATS_BUCKETS && len >= 0; ++i) {
+    if (stats->buckets[phase][i] == 0) {
+      continue;
+    }
+    // Buckets are named by their lower bound.
+    size_t used = ((size_t)len < size) ? (size_t)len : size;
+    len += snprintf(buf + used, size - used, "%s%lldns:%u", sep,
+                    (i == 0) ? 0 : 1LL << i,
+                    (unsigned)stats->buckets[phase][i]);
+    sep = ",";
+  }
+  return len;
+}
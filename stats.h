@@ -0,0 +1,41 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h> // for size_t
+#include <stdint.h> // for uint32_t
+
+// Phases of an authentication timed by the stats= option.
+enum {
+  STATS_GET_USER,
+  STATS_BUILD_CONFIG,
+  STATS_MAKE_QUESTION,
+  STATS_CONV,
+  STATS_CHECK_ANSWER,
+  STATS_FREE_CONFIG,
+  STATS_PHASES
+};
+
+// Bucket i counts the durations from 2^i up to 2^(i+1) nanoseconds; the last
+// one also all longer ones.
+#define STATS_BUCKETS 40
+
+typedef struct {
+  long long total_ns[STATS_PHASES];
+  uint32_t buckets[STATS_PHASES][STATS_BUCKETS];
+} stats_t;
+
+// Returns the time to pass to stats_add, or 0 if stats is NULL, so that
+// nothing is timed unless stats were asked for.
+long long stats_start(const stats_t *stats);
+
+// Adds the time since start to the phase, n times divided by n.
+void stats_add(stats_t *stats, int phase, long long start, int n);
+
+// Returns the name of a phase, e.g. "conv".
+const char *stats_phase_name(int phase);
+
+// Formats the count, total and histogram of a phase like snprintf, or returns
+// 0 if nothing was timed in it.
+int stats_format(const stats_t *stats, int phase, char *buf, size_t size);
+
+#endif
@@ -0,0 +1,266 @@
+#define _POSIX_C_SOURCE 200809L
+
+// Runs authentications from many threads at once against the given modules,
+// loaded like libpam does, for every user of every PAM config file given, and
+// reports throughput, latency and answers the modules did not accept.
+
+#include <dlfcn.h>                // for dlopen, dlsym, dlerror, RTLD_LOCAL
+#include <pthread.h>              // for pthread_create, pthread_join, ...
+#include <security/pam_appl.h>    // for PAM_AUTH_ERR, PAM_SUCCESS
+#include <security/pam_modules.h> // for pam_handle_t
+#include <stdio.h>                // for fprintf, printf, snprintf, NULL, ...
+#include <stdlib.h>               // for free, calloc, malloc, qsort, atoi, ...
+#include <string.h>               // for strcmp, strrchr
+#include <unistd.h>               // for sysconf, _SC_NPROCESSORS_ONLN
+
+#include "fake_pam.h" // for fake_pam_script_t, oracle_t, fake_pam_...
+#include "helpers.h"  // for random_init
+
+#define MODULES_MAX 8
+#define CONFIGS_MAX 64
+#define TARGETS_MAX 256
+#define THREADS_MAX 256
+
+typedef int (*authenticate_t)(pam_handle_t *pamh, int flags, int argc,
+                              const char **argv);
+
+// A user of a config file to authenticate.
+typedef struct {
+  const char *config_name;
+  fake_pam_config_t *config;
+  char *user;
+  authenticate_t authenticate;
+  const oracle_t *oracle;
+  void *oracle_state;
+} target_t;
+
+typedef struct {
+  const target_t *targets;
+  int num_targets;
+  int first_target;
+  int iterations;
+  double p_correct;
+  long long *latencies;
+  long ok, failed, errors, mismatches, unknown;
+} worker_t;
+
+static const oracle_t *const oracles[] = {&math_oracle,
+                                          &questions_file_oracle};
+
+static void *work(void *ctx) {
+  worker_t *worker = ctx;
+  fake_pam_script_t script = {.p_correct = worker->p_correct};
+  random_init(&script.rng);
+  for (int i = 0; i < worker->iterations; ++i) {
+    const target_t *target =
+        &worker->targets[(worker->first_target + i) % worker->num_targets];
+    script.oracle = target->oracle;
+    script.oracle_state = target->oracle_state;
+    pam_handle_t pamh;
+    fake_pam_start(&pamh, target->user, &script);
+    int result = target->authenticate(&pamh, 0, target->config->num_args,
+                                      target->config->args);
+    worker->latencies[i] = fake_pam_now_ns() - script.start;
+    fake_pam_end(&pamh);
+    if (result == PAM_SUCCESS) {
+      ++worker->ok;
+    } else if (result == PAM_AUTH_ERR) {
+      ++worker->failed;
+    } else {
+      ++worker->errors;
+    }
+    // All answers were right, so the module must have accepted them.
+    if (result != PAM_SUCCESS && !script.answered_wrong) {
+      ++worker->mismatches;
+      fprintf(stderr, "ERROR: %s %s: correct answers not accepted: %s\n",
+              target->config_name, target->user, pam_strerror(&pamh, result));
+    }
+  }
+  worker->unknown = script.unknown;
+  return NULL;
+}
+
+static int compare_ll(const void *a, const void *b) {
+  long long x = *(const long long *)a, y = *(const long long *)b;
+  return (x > y) - (x < y);
+}
+
+static int run(const target_t *targets, int num_targets, int threads,
+               int iterations, double p_correct) {
+  worker_t *workers = calloc(threads, sizeof(worker_t));
+  pthread_t *ids = calloc(threads, sizeof(pthread_t));
+  long long *latencies =
+      malloc((size_t)threads * iterations * sizeof(long long));
+  if (workers == NULL || ids == NULL || latencies == NULL) {
+    fprintf(stderr, "ERROR: could not allocate workers\n");
+    free(workers);
+    free(ids);
+    free(latencies);
+    return 0;
+  }
+  long long start = fake_pam_now_ns();
+  int started = 0;
+  for (; started < threads; ++started) {
+    worker_t *worker = &workers[started];
+    worker->targets = targets;
+    worker->num_targets = num_targets;
+    worker->first_target = started;
+    worker->iterations = iterations;
+    worker->p_correct = p_correct;
+    worker->latencies = latencies + (size_t)started * iterations;
+    if (pthread_create(&ids[started], NULL, work, worker) != 0) {
+      fprintf(stderr, "ERROR: could not start thread\n");
+      break;
+    }
+  }
+  long ok = 0, failed = 0, errors = 0, mismatches = 0, unknown = 0;
+  for (int i = 0; i < started; ++i) {
+    pthread_join(ids[i], NULL);
+    ok += workers[i].ok;
+    failed += workers[i].failed;
+    errors += workers[i].errors;
+    mismatches += workers[i].mismatches;
+    unknown += workers[i].unknown;
+  }
+  long long end = fake_pam_now_ns();
+  size_t total = (size_t)started * iterations;
+  qsort(latencies, total, sizeof(long long), compare_ll);
+  if (total > 0) {
+    printf("%d threads, %d targets: %.0f auth/s, p50 %.2f us, p99 %.2f us, "
+           "p99.9 %.2f us; %ld ok, %ld failed, %ld errors, %ld mismatches, "
+           "%ld unknown questions\n",
+           started, num_targets, total / ((end - start) / 1e9),
+           latencies[total / 2] / 1e3,
+           latencies[total - 1 - total / 100] / 1e3,
+           latencies[total - 1 - total / 1000] / 1e3, ok, failed, errors,
+           mismatches, unknown);
+  }
+  free(workers);
+  free(ids);
+  free(latencies);
+  return started == threads && errors == 0 && mismatches == 0;
+}
+
+// Adds a target per user of the config file using the module.
+static int add_targets(const char *name, const char *module_path,
+                       authenticate_t authenticate, const oracle_t *oracle,
+                       fake_pam_config_t *configs, int *num_configs,
+                       target_t *targets, int *num_targets) {
+  const char *base = strrchr(module_path, '/');
+  base = (base == NULL) ? module_path : base + 1;
+  if (*num_configs == CONFIGS_MAX) {
+    fprintf(stderr, "ERROR: too many configs\n");
+    return 0;
+  }
+  fake_pam_config_t *config = &configs[*num_configs];
+  int found = fake_pam_parse_config(name, base, config);
+  if (found <= 0) {
+    return found == 0;
+  }
+  ++*num_configs;
+  char *users[FAKE_PAM_USERS_MAX];
+  int num_users = fake_pam_find_users(config, users);
+  for (int i = 0; i < num_users; ++i) {
+    void *state = NULL;
+    if (*num_targets < TARGETS_MAX) {
+      state = oracle->init(users[i], config->num_args, config->args);
+    }
+    if (state == NULL) {
+      fprintf(stderr, "ERROR: could not prepare answers for %s %s\n", name,
+              users[i]);
+      free(users[i]);
+      continue;
+    }
+    target_t *target = &targets[(*num_targets)++];
+    target->config_name = name;
+    target->config = config;
+    target->user = users[i];
+    target->authenticate = authenticate;
+    target->oracle = oracle;
+    target->oracle_state = state;
+  }
+  return 1;
+}
+
+int main(int argc, char **argv) {
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int threads = (cpus < 1) ? 1 : (cpus > THREADS_MAX) ? THREADS_MAX : cpus;
+  int iterations = 10000;
+  double p_correct = 1;
+  const char *modules[MODULES_MAX];
+  int num_modules = 0;
+  int i = 1;
+  for (; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+    if (!strcmp(argv[i], "-t")) {
+      threads = atoi(argv[i + 1]);
+    } else if (!strcmp(argv[i], "-n")) {
+      iterations = atoi(argv[i + 1]);
+    } else if (!strcmp(argv[i], "-p")) {
+      p_correct = strtod(argv[i + 1], NULL);
+    } else if (!strcmp(argv[i], "-m") && num_modules < MODULES_MAX) {
+      modules[num_modules++] = argv[i + 1];
+    } else {
+      break;
+    }
+  }
+  if (i >= argc || num_modules == 0 || threads <= 0 ||
+      threads > THREADS_MAX || iterations <= 0) {
+    fprintf(stderr,
+            "Usage: %s [-t threads] [-n authentications per thread] "
+            "[-p probability of correct answers] -m module.so... "
+            "pam_config...\n",
+            argv[0]);
+    return 1;
+  }
+
+  static fake_pam_config_t configs[CONFIGS_MAX];
+  static target_t targets[TARGETS_MAX];
+  int num_configs = 0, num_targets = 0;
+  int status = 0;
+  for (int m = 0; m < num_modules; ++m) {
+    const oracle_t *oracle = NULL;
+    const char *base = strrchr(modules[m], '/');
+    base = (base == NULL) ? modules[m] : base + 1;
+    for (size_t o = 0; o < sizeof(oracles) / sizeof(*oracles); ++o) {
+      char name[256];
+      snprintf(name, sizeof(name), "%s.so", oracles[o]->module_name);
+      if (!strcmp(base, name)) {
+        oracle = oracles[o];
+      }
+    }
+    // The module resolves the pam_* functions to those of fake_pam.c.
+    void *handle = dlopen(modules[m], RTLD_NOW | RTLD_LOCAL);
+    authenticate_t authenticate = NULL;
+    if (handle != NULL) {
+      // Like POSIX recommends, as ISO C has no cast to function pointers.
+      *(void **)&authenticate = dlsym(handle, "pam_sm_authenticate");
+    }
+    if (oracle == NULL || authenticate == NULL) {
+      fprintf(stderr, "ERROR: cannot use module %s: %s\n", modules[m],
+              (oracle == NULL) ? "unknown module" : dlerror());
+      status = 1;
+      continue;
+    }
+    for (int j = i; j < argc; ++j) {
+      if (!add_targets(argv[j], modules[m], authenticate, oracle, configs,
+                       &num_configs, targets, &num_targets)) {
+        status = 1;
+      }
+    }
+  }
+  if (num_targets == 0) {
+    fprintf(stderr, "ERROR: no config uses the modules\n");
+    return 1;
+  }
+  if (!run(targets, num_targets, threads, iterations, p_correct)) {
+    status = 1;
+  }
+  for (int t = 0; t < num_targets; ++t) {
+    targets[t].oracle->free(targets[t].oracle_state);
+    free(targets[t].user);
+  }
+  for (int c = 0; c < num_configs; ++c) {
+    fake_pam_free_config(&configs[c]);
+  }
+  return status;
+}
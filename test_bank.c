@@ -0,0 +1,160 @@
+#define _POSIX_C_SOURCE 200809L
+
+// Checks that a bank compiled by pam_questions_compile holds the same groups,
+// rows and weights as the CSV file it was compiled from, as loaded by the
+// source cache.
+//
+// Usage: test_bank questions.csv questions.bank
+
+#include <stdio.h>  // for printf, fprintf, stderr, NULL
+#include <stdlib.h> // for free, malloc, qsort
+#include <string.h> // for strcmp
+
+#include "alias.h"        // for alias_t
+#include "bank.h"         // for bank_string, bank_row
+#include "source_cache.h" // for source_t, source_acquire, source_release
+
+// A group of either kind of source, for sorting by match value.
+typedef struct {
+  const source_t *source;
+  int index;
+  const char *match;
+} group_ref_t;
+
+static const char *row_string(const source_t *source, int row, int answer) {
+  if (source->is_bank) {
+    const bank_row *r = &source->bank.rows[row];
+    return bank_string(&source->bank, answer ? r->answer : r->question);
+  }
+  return answer ? source->rows[row].answer : source->rows[row].question;
+}
+
+static int num_groups(const source_t *source) {
+  return source->is_bank ? (int)source->bank.header->num_groups
+                         : source->num_groups;
+}
+
+static void group_rows(const source_t *source, int group, int *first,
+                       int *num) {
+  if (source->is_bank) {
+    *first = source->bank.groups[group].first_row;
+    *num = source->bank.groups[group].num_rows;
+  } else {
+    *first = source->groups[group].first_row;
+    *num = source->groups[group].num_rows;
+  }
+}
+
+static const alias_t *row_alias(const source_t *source, int row) {
+  if (source->is_bank) {
+    return (source->bank.alias == NULL) ? NULL : &source->bank.alias[row];
+  }
+  return source->weighted ? &source->alias[row] : NULL;
+}
+
+static int compare_groups(const void *a, const void *b) {
+  return strcmp(((const group_ref_t *)a)->match,
+                ((const group_ref_t *)b)->match);
+}
+
+// Returns the groups of a source that have rows, sorted by match value, or
+// NULL on failure. Loaded CSV files may have an empty group for rows without
+// a match value, which banks leave out.
+static group_ref_t *sorted_groups(const source_t *source, int *n) {
+  group_ref_t *groups = malloc((num_groups(source) + 1) * sizeof(*groups));
+  if (groups == NULL) {
+    return NULL;
+  }
+  *n = 0;
+  for (int g = 0; g < num_groups(source); ++g) {
+    int first, num;
+    group_rows(source, g, &first, &num);
+    if (num == 0) {
+      continue;
+    }
+    group_ref_t *group = &groups[(*n)++];
+    group->source = source;
+    group->index = g;
+    group->match =
+        source->is_bank
+            ? bank_string(&source->bank, source->bank.groups[g].match)
+            : source->groups[g].match;
+    if (group->match == NULL) {
+      group->match = "";
+    }
+  }
+  qsort(groups, *n, sizeof(*groups), compare_groups);
+  return groups;
+}
+
+// Returns the number of differences between two groups.
+static int compare_group(const group_ref_t *csv, const group_ref_t *bank) {
+  int csv_first, csv_num, bank_first, bank_num;
+  group_rows(csv->source, csv->index, &csv_first, &csv_num);
+  group_rows(bank->source, bank->index, &bank_first, &bank_num);
+  if (strcmp(csv->match, bank->match) || csv_num != bank_num) {
+    printf("FAIL: group %s has %d rows, but %d in the bank\n", csv->match,
+           csv_num, bank_num);
+    return 1;
+  }
+  int failures = 0;
+  // Rows keep their order within a group, which the alias tables rely on.
+  for (int i = 0; i < csv_num; ++i) {
+    for (int answer = 0; answer <= 1; ++answer) {
+      const char *expected = row_string(csv->source, csv_first + i, answer);
+      const char *got = row_string(bank->source, bank_first + i, answer);
+      if (got == NULL || strcmp(expected, got)) {
+        printf("FAIL: group %s row %d: \"%s\", but \"%s\" in the bank\n",
+               csv->match, i, expected, (got == NULL) ? "(corrupt)" : got);
+        ++failures;
+      }
+    }
+    const alias_t *expected = row_alias(csv->source, csv_first + i);
+    const alias_t *got = row_alias(bank->source, bank_first + i);
+    if ((expected == NULL) != (got == NULL) ||
+        (expected != NULL && (expected->prob != got->prob ||
+                              expected->alias != got->alias))) {
+      printf("FAIL: group %s row %d: weights differ\n", csv->match, i);
+      ++failures;
+    }
+  }
+  return failures;
+}
+
+int main(int argc, char **argv) {
+  if (argc != 3) {
+    fprintf(stderr, "Usage: %s questions.csv questions.bank\n", argv[0]);
+    return 1;
+  }
+  source_t *csv = source_acquire(argv[1], 1);
+  source_t *bank = source_acquire(argv[2], 1);
+  if (csv == NULL || bank == NULL || csv->is_bank || !bank->is_bank) {
+    printf("FAIL: could not load %s as CSV and %s as bank\n", argv[1],
+           argv[2]);
+    return 1;
+  }
+  int failures = 0;
+  int num_csv_groups = 0, num_bank_groups = 0;
+  group_ref_t *csv_groups = sorted_groups(csv, &num_csv_groups);
+  group_ref_t *bank_groups = sorted_groups(bank, &num_bank_groups);
+  if (csv_groups == NULL || bank_groups == NULL) {
+    printf("FAIL: could not allocate groups\n");
+    ++failures;
+  } else if (num_csv_groups != num_bank_groups) {
+    printf("FAIL: %d groups, but %d in the bank\n", num_csv_groups,
+           num_bank_groups);
+    ++failures;
+  } else {
+    for (int g = 0; g < num_csv_groups; ++g) {
+      failures += compare_group(&csv_groups[g], &bank_groups[g]);
+    }
+  }
+  printf("%s: %d groups, %d rows, %d differences\n", argv[1], num_csv_groups,
+         csv->num_rows, failures);
+  free(bank_groups);
+  free(csv_groups);
+  source_release(bank);
+  source_release(csv);
+  printf(failures == 0 ? "PASS\n" : "FAIL\n");
+  return failures != 0;
+}
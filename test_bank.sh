@@ -0,0 +1,29 @@
+#!/bin/sh
+
+# Compiles questions files to banks and checks that the banks hold the same
+# questions as the CSV files.
+
+set -ex
+
+tmpdir=$(mktemp -d -t pam_math_test.XXXXXX)
+trap 'rm -rf "$tmpdir"' EXIT
+
+cp examples/questions.csv "$tmpdir/examples.csv"
+
+# Quoted fields, CRLF line ends, an empty match value and weights, including
+# empty and zero ones.
+printf '%s\r\n' \
+	'weight,question,answer,match' \
+	'2,"Say ""hi"":",hi,greetings' \
+	',"What is 1, 2?",3,' \
+	'0,Never asked?,no,greetings' \
+	'0.5,Half?,yes,half' \
+	'3,Last?,yes,greetings' > "$tmpdir/weighted.csv"
+
+# Many groups and rows, with extra columns.
+./gen_questions -r 5000 -m 100 -q 0.3 -c 2 > "$tmpdir/generated.csv"
+
+for csv in "$tmpdir"/*.csv; do
+	./pam_questions_compile "$csv" "${csv%.csv}.bank"
+	./test_bank "$csv" "${csv%.csv}.bank"
+done
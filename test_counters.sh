@@ -0,0 +1,53 @@
+#!/bin/sh
+
+# Authenticates with counters= set, and checks what pam_math_counters reports
+# and that files of another module or with a wrong magic are refused.
+
+set -ex
+
+tmpdir=$(mktemp -d -t pam_math_test.XXXXXX)
+trap 'rm -rf "$tmpdir"' EXIT
+
+counters=$tmpdir/pam_math.counters
+cat > "$tmpdir/math" <<EOT
+auth required pam_math.so .questions=2 .ops=+- .counters=$counters
+EOT
+cat > "$tmpdir/questions_file" <<EOT
+auth required pam_questions_file.so .questions=2 \
+	.file=examples/questions.csv .counters=$counters
+EOT
+
+# 2 threads of 50 authentications, all answered correctly.
+./stress -t 2 -n 50 -p 1 -m ./pam_math.so "$tmpdir/math"
+test -f "$counters"
+./pam_math_counters "$counters" > "$tmpdir/out.prom"
+labels="{module=\"pam_math\",file=\"$counters\"}"
+grep -qx "pam_math_sessions_total$labels 100" "$tmpdir/out.prom"
+grep -qx "pam_math_questions_total$labels 200" "$tmpdir/out.prom"
+grep -qx "pam_math_exhausted_total$labels 0" "$tmpdir/out.prom"
+correct=$(sed -n 's/^pam_math_answers_total{.*result="correct"} //p' \
+	"$tmpdir/out.prom" | awk '{ n += $1 } END { print n }')
+test "$correct" -eq 200
+
+# Another module must not count into the file.
+./stress -t 1 -n 10 -p 1 -m ./pam_questions_file.so \
+	"$tmpdir/questions_file" 2> "$tmpdir/stderr"
+grep -q "is not one of pam_questions_file" "$tmpdir/stderr"
+./pam_math_counters "$counters" > "$tmpdir/out.prom"
+grep -qx "pam_math_sessions_total$labels 100" "$tmpdir/out.prom"
+
+# Neither must the module count into a file with a wrong magic, which the
+# exporter refuses too.
+head -c 4096 /dev/urandom > "$counters"
+./stress -t 1 -n 10 -p 1 -m ./pam_math.so "$tmpdir/math" 2> "$tmpdir/stderr"
+grep -q "is not one of pam_math" "$tmpdir/stderr"
+if ./pam_math_counters "$counters" > /dev/null; then
+	exit 1
+fi
+
+# Nor follow a symlink.
+rm "$counters"
+ln -s "$tmpdir/target" "$counters"
+./stress -t 1 -n 10 -p 1 -m ./pam_math.so "$tmpdir/math" 2> "$tmpdir/stderr"
+grep -q "could not open counters file" "$tmpdir/stderr"
+test ! -e "$tmpdir/target"
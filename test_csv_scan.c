@@ -0,0 +1,207 @@
+// Checks that the SIMD implementations of csv_scan and csv_classify find the
+// same characters as the scalar ones, for all classes, around block
+// boundaries, and on quoted fields and CRLF line ends, and that csv_read_span
+// reads back fields of all lengths.
+
+#include <stdint.h> // for uint32_t
+#include <stdio.h>  // for printf, NULL
+#include <string.h> // for memcmp, memcpy, memset, strlen, strpbrk
+
+#include "csv.h"      // for csv_buf, csv_read_span, csv_span, csv_start
+#include "csv_scan.h" // for csv_scanner_named, csv_scanner, CSV_COMMA, ...
+
+// Room for strings crossing a few 32 and 64 byte blocks at any alignment.
+#define TEXT_MAX 256
+#define FIELDS_MAX 8
+
+static const char *const impls[] = {"sse2", "avx2"};
+
+static const char *const samples[] = {
+    "",
+    "a",
+    ",",
+    "question,answer,match",
+    "\"Say \"\"hello\"\", world:\",\"hello, world\",greetings\r\n",
+    "What is the capital of Germany?,Berlin,capitals\r\nnext,row\r\n",
+    "\"multi\r\nline\nfield\"\r\n",
+    "\xc3\xa4\xc3\xb6\xc3\xbc,\x80\xff\"\x7f\r",
+};
+
+// Returns the number of classifiers disagreeing with scalar on text.
+static int check_classify(const char *text, size_t len, char *buf) {
+  csv_classifier *scalar = csv_classifier_named("scalar");
+  int failures = 0;
+  // Room for a whole block after the text.
+  memset(buf, 0, TEXT_MAX + CSV_BLOCK);
+  memcpy(buf, text, len);
+  for (size_t start = 0; start <= len; ++start) {
+    csv_mask expected, got;
+    scalar(buf + start, &expected);
+    for (size_t i = 0; i < sizeof(impls) / sizeof(*impls); ++i) {
+      csv_classifier *classify = csv_classifier_named(impls[i]);
+      if (classify == NULL) {
+        continue;
+      }
+      classify(buf + start, &got);
+      if (memcmp(&got, &expected, sizeof(got))) {
+        printf("FAIL: %s classifies %zu bytes from %zu wrongly\n", impls[i],
+               len, start);
+        ++failures;
+      }
+    }
+    // Partial blocks must not get bits past their end.
+    csv_classify(buf + start, buf + len, &got);
+    uint32_t valid = (len - start >= CSV_BLOCK)
+                         ? (uint32_t)-1
+                         : ((uint32_t)1 << (len - start)) - 1;
+    if (got.comma != (expected.comma & valid) ||
+        got.quote != (expected.quote & valid) ||
+        got.eol != (expected.eol & valid)) {
+      printf("FAIL: csv_classify on %zu bytes from %zu\n", len, start);
+      ++failures;
+    }
+  }
+  return failures;
+}
+
+// Returns the number of implementations disagreeing with scalar on text.
+static int check(const char *text, size_t len, char *buf) {
+  csv_scanner *scalar = csv_scanner_named("scalar");
+  int failures = 0;
+  for (size_t i = 0; i < sizeof(impls) / sizeof(*impls); ++i) {
+    csv_scanner *scan = csv_scanner_named(impls[i]);
+    if (scan == NULL) {
+      continue;
+    }
+    for (unsigned want = 1; want <= (CSV_COMMA | CSV_QUOTE | CSV_EOL);
+         ++want) {
+      // Every start offset, so that each special character is found both as
+      // the first and as a later one in a block.
+      for (size_t start = 0; start <= len; ++start) {
+        memcpy(buf, text, len);
+        char *expected = scalar(buf + start, buf + len, want);
+        char *got = scan(buf + start, buf + len, want);
+        if (got != expected) {
+          printf("FAIL: %s on %zu bytes from %zu, want %u: %td, not %td\n",
+                 impls[i], len, start, want, got - buf, expected - buf);
+          ++failures;
+        }
+      }
+    }
+  }
+  return failures + check_classify(text, len, buf);
+}
+
+// Writes fields as a line of CSV, quoting those that need it, reads it back
+// and returns the number of fields read wrongly.
+static int check_fields(const char *const *fields, int num_fields) {
+  static char line[4 * TEXT_MAX];
+  char *out = line;
+  for (int f = 0; f < num_fields; ++f) {
+    if (f > 0) {
+      *out++ = ',';
+    }
+    int quote = strpbrk(fields[f], ",\"") != NULL;
+    if (quote) {
+      *out++ = '"';
+    }
+    for (const char *c = fields[f]; *c; ++c) {
+      if (*c == '"') {
+        *out++ = '"';
+      }
+      *out++ = *c;
+    }
+    if (quote) {
+      *out++ = '"';
+    }
+  }
+  memcpy(out, "\r\nnext,line", 11);
+  char *end = out + 11;
+  csv_buf buf;
+  if (csv_start(line, end, &buf) != out + 2) {
+    printf("FAIL: line of %d fields ends in the wrong place\n", num_fields);
+    return 1;
+  }
+  int failures = 0;
+  csv_span span;
+  int f = 0;
+  for (; csv_read_span(&buf, &span); ++f) {
+    if (f >= num_fields || span.len != strlen(fields[f]) ||
+        memcmp(span.ptr, fields[f], span.len)) {
+      printf("FAIL: field %d of %d read wrongly\n", f, num_fields);
+      ++failures;
+    }
+  }
+  if (f != num_fields) {
+    printf("FAIL: %d fields read of %d\n", f, num_fields);
+    ++failures;
+  }
+  return failures;
+}
+
+int main(void) {
+  if (csv_scanner_named("scalar") == NULL ||
+      csv_classifier_named("scalar") == NULL) {
+    printf("FAIL: no scalar implementation\n");
+    return 1;
+  }
+  static char text[TEXT_MAX], buf[TEXT_MAX + CSV_BLOCK];
+  int failures = 0;
+  for (size_t i = 0; i < sizeof(samples) / sizeof(*samples); ++i) {
+    failures += check(samples[i], strlen(samples[i]), buf);
+  }
+  // A single special character, or a CRLF, at every position of texts
+  // ending before, at and after 32 and 64 byte boundaries.
+  static const char *const specials[] = {",", "\"", "\r", "\n", "\r\n",
+                                         "\"\""};
+  static const size_t lens[] = {31, 32, 33, 63, 64, 65, 96, 128, 129};
+  for (size_t s = 0; s < sizeof(specials) / sizeof(*specials); ++s) {
+    size_t special_len = strlen(specials[s]);
+    for (size_t l = 0; l < sizeof(lens) / sizeof(*lens); ++l) {
+      for (size_t pos = 0; pos + special_len <= lens[l]; ++pos) {
+        memset(text, 'x', lens[l]);
+        memcpy(text + pos, specials[s], special_len);
+        failures += check(text, lens[l], buf);
+      }
+    }
+  }
+  // Pseudo-random mixes of special and other characters.
+  static const char alphabet[] = "ab,\"\r\n \x80";
+  unsigned int x = 1;
+  for (int round = 0; round < 200; ++round) {
+    size_t len = round % (TEXT_MAX / 2);
+    for (size_t i = 0; i < len; ++i) {
+      x = x * 1103515245 + 12345;
+      // Mostly plain characters, so that blocks without specials occur.
+      int c = (x >> 16) % 64;
+      text[i] = (c < (int)sizeof(alphabet) - 1) ? alphabet[c] : 'y';
+    }
+    failures += check(text, len, buf);
+  }
+  // Lines of pseudo-random fields, short ones sharing a block and long ones
+  // spanning several.
+  static char field_text[FIELDS_MAX][TEXT_MAX / 2];
+  const char *fields[FIELDS_MAX];
+  for (int round = 0; round < 2000; ++round) {
+    x = x * 1103515245 + 12345;
+    int num_fields = 1 + (x >> 16) % FIELDS_MAX;
+    for (int f = 0; f < num_fields; ++f) {
+      x = x * 1103515245 + 12345;
+      size_t len = (x >> 16) % ((round % 2) ? 8 : TEXT_MAX / 2);
+      for (size_t i = 0; i < len; ++i) {
+        x = x * 1103515245 + 12345;
+        int c = (x >> 16) % 16;
+        field_text[f][i] = (c < 3) ? ",\"a"[c] : 'y';
+      }
+      field_text[f][len] = 0;
+      fields[f] = field_text[f];
+    }
+    failures += check_fields(fields, num_fields);
+  }
+  for (size_t i = 0; i < sizeof(impls) / sizeof(*impls); ++i) {
+    printf("%s: %s\n", impls[i],
+           csv_scanner_named(impls[i]) != NULL ? "tested" : "not supported");
+  }
+  printf(failures == 0 ? "PASS\n" : "FAIL\n");
+  return failures != 0;
+}
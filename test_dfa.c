@@ -0,0 +1,179 @@
+#define _POSIX_C_SOURCE 200809L
+
+// Checks dfa_match against regexec on the patterns of the examples and some
+// more, in the C locale and in a UTF-8 one, and from several threads at once.
+
+#include <locale.h>  // for setlocale, LC_ALL
+#include <pthread.h> // for pthread_create, pthread_join, pthread_t
+#include <regex.h>   // for regcomp, regexec, regfree, regex_t, REG_EXTENDED
+#include <stdio.h>   // for printf, snprintf, NULL
+#include <stdlib.h>  // for MB_CUR_MAX
+#include <string.h>  // for strcmp
+
+#include "dfa.h" // for dfa_compile, dfa_free, dfa_match, dfa_t
+
+#define PATTERN_MAX 256
+#define THREADS 8
+// Long enough for the last pattern to need more states than the DFA caches.
+#define RANDOM_LEN 4096
+
+static char random_ab[RANDOM_LEN + 1];
+
+static const char *const patterns[] = {
+    "capitals",
+    "binomial",
+    "capitals|binomial",
+    ".*",
+    "m1",
+    "m[0-9]*7",
+    "[a-c]+",
+    "[^a-c]*",
+    "(ab|c)*d?",
+    "a{2,3}b{0,1}",
+    "[[:alpha:]_][[:alnum:]_]*",
+    "[[:space:]]*x[[:space:]]*",
+    "(a|b)*a(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)",
+    "caf.",
+    "[é]",
+    "x\\.y",
+};
+
+static const char *const strings[] = {
+    "",
+    "capitals",
+    "binomial",
+    "capital",
+    "capitalss",
+    "m1",
+    "m17",
+    "m1234567",
+    "m12345678",
+    "abcabc",
+    "abcd",
+    "xyz",
+    "ababcd",
+    "cd",
+    "aab",
+    "aaab",
+    "aaaab",
+    "_id42",
+    "4id",
+    "  x ",
+    "x.y",
+    "xzy",
+    "café",
+    "cafe",
+    "é",
+    "\xc3",
+    "abaaaaaaaaaa",
+    "abbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbb",
+    "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaabbbb"
+    "bbbbbbbbbbababababababababbbabababababaaaaaaaaaabbbbbbbbbbaaaaaaaabab",
+    random_ab,
+};
+
+// Patterns whose meaning depends on characters rather than bytes, so that in a
+// multibyte locale the DFA has to leave them to regexec.
+static const char *const multibyte_patterns[] = {".*", "[^a-c]*", "caf.",
+                                                 "[é]"};
+
+#define NUM_PATTERNS (int)(sizeof(patterns) / sizeof(*patterns))
+#define NUM_STRINGS (int)(sizeof(strings) / sizeof(*strings))
+
+typedef struct {
+  dfa_t *dfa;
+  const int *expected;
+  int failures;
+} check_t;
+
+static void *check_strings(void *ctx) {
+  check_t *check = ctx;
+  for (int round = 0; round < 10; ++round) {
+    for (int i = 0; i < NUM_STRINGS; ++i) {
+      if (dfa_match(check->dfa, strings[i]) != check->expected[i]) {
+        ++check->failures;
+      }
+    }
+  }
+  return NULL;
+}
+
+// Returns the number of mismatches between the DFA and regexec.
+static int test_pattern(const char *locale, const char *pattern) {
+  char full[PATTERN_MAX];
+  snprintf(full, sizeof(full), "^(%s)$", pattern);
+  regex_t regex;
+  if (regcomp(&regex, full, REG_EXTENDED | REG_NOSUB) != 0) {
+    printf("FAIL: %s: regcomp failed on %s\n", locale, pattern);
+    return 1;
+  }
+  int expected[NUM_STRINGS];
+  for (int i = 0; i < NUM_STRINGS; ++i) {
+    expected[i] = regexec(&regex, strings[i], 0, NULL, 0) == 0;
+  }
+  regfree(&regex);
+
+  dfa_t *dfa = dfa_compile(pattern);
+  if (dfa != NULL && MB_CUR_MAX > 1) {
+    for (size_t i = 0;
+         i < sizeof(multibyte_patterns) / sizeof(*multibyte_patterns); ++i) {
+      if (!strcmp(pattern, multibyte_patterns[i])) {
+        printf("FAIL: %s: %s should be left to regexec\n", locale, pattern);
+        dfa_free(dfa);
+        return 1;
+      }
+    }
+  }
+  if (dfa == NULL) {
+    // Left to regexec, which is always correct.
+    printf("%s: %s: regexec\n", locale, pattern);
+    return 0;
+  }
+  pthread_t threads[THREADS];
+  check_t checks[THREADS];
+  for (int t = 0; t < THREADS; ++t) {
+    checks[t].dfa = dfa;
+    checks[t].expected = expected;
+    checks[t].failures = 0;
+    pthread_create(&threads[t], NULL, check_strings, &checks[t]);
+  }
+  int failures = 0;
+  for (int t = 0; t < THREADS; ++t) {
+    pthread_join(threads[t], NULL);
+    failures += checks[t].failures;
+  }
+  for (int i = 0; i < NUM_STRINGS; ++i) {
+    if (dfa_match(dfa, strings[i]) != expected[i]) {
+      printf("FAIL: %s: %s on \"%s\": dfa %d, regexec %d\n", locale, pattern,
+             strings[i], !expected[i], expected[i]);
+    }
+  }
+  dfa_free(dfa);
+  printf("%s: %s: dfa, %d mismatches\n", locale, pattern, failures);
+  return failures;
+}
+
+int main(void) {
+  unsigned int x = 1;
+  for (int i = 0; i < RANDOM_LEN; ++i) {
+    x = x * 1103515245 + 12345;
+    random_ab[i] = ((x >> 16) & 1) ? 'a' : 'b';
+  }
+  static const char *const locales[] = {"C", "C.UTF-8"};
+  int failures = 0;
+  for (size_t l = 0; l < sizeof(locales) / sizeof(*locales); ++l) {
+    if (setlocale(LC_ALL, locales[l]) == NULL) {
+      printf("%s: locale not available, skipped\n", locales[l]);
+      continue;
+    }
+    for (int p = 0; p < NUM_PATTERNS; ++p) {
+      failures += test_pattern(locales[l], patterns[p]);
+    }
+  }
+  if (failures != 0) {
+    printf("FAIL: %d mismatches\n", failures);
+    return 1;
+  }
+  printf("PASS\n");
+  return 0;
+}
@@ -0,0 +1,91 @@
+#define _POSIX_C_SOURCE 200809L
+
+// Checks that for_each_option finds users in a config_db file, applies their
+// fields in place of the config_db argument, and notices when it changes.
+
+#include <stdio.h>  // for printf, perror, fopen, fputs, fclose, snprintf
+#include <stdlib.h> // for mkdtemp
+#include <string.h> // for strcmp, strlen
+#include <unistd.h> // for rmdir, unlink
+
+#include "options.h" // for for_each_option, options_version
+
+#define FIELDS_MAX 4096
+
+static void append_field(void *ctx, const char *field,
+                         const char *arg __attribute__((unused))) {
+  char *fields = ctx;
+  size_t len = strlen(fields);
+  snprintf(fields + len, FIELDS_MAX - len, "%s%s", (len == 0) ? "" : " ",
+           field);
+}
+
+static int write_file(const char *name, const char *contents) {
+  FILE *f = fopen(name, "w");
+  if (f == NULL) {
+    perror(name);
+    return 0;
+  }
+  fputs(contents, f);
+  return fclose(f) == 0;
+}
+
+// Returns 1 if the fields applying to user are as expected.
+static int check(const char *user, int argc, const char **argv,
+                 const char *expected) {
+  char fields[FIELDS_MAX] = "";
+  for_each_option(user, argc, argv, append_field, fields);
+  if (strcmp(fields, expected)) {
+    printf("FAIL: %s: got \"%s\", want \"%s\"\n", user, fields, expected);
+    return 0;
+  }
+  printf("%s: %s\n", user, fields);
+  return 1;
+}
+
+int main(void) {
+  char dir[] = "/tmp/test_options.XXXXXX";
+  if (mkdtemp(dir) == NULL) {
+    perror("mkdtemp");
+    return 1;
+  }
+  char db[sizeof(dir) + 16], db_arg[sizeof(dir) + 32];
+  snprintf(db, sizeof(db), "%s/config_db", dir);
+  snprintf(db_arg, sizeof(db_arg), ".config_db=%s", db);
+
+  int ok = write_file(db, "# user  settings\n"
+                          "k1      questions=3 ops=+-\n"
+                          "\n"
+                          "  k2\tquestions=0\n"
+                          "k1      questions=9\n"
+                          "k10     attempts=1");
+  const char *argv[] = {".questions=1", "k1.attempts=5", db_arg,
+                        "k2.questions=2", ".batch=1"};
+  int argc = sizeof(argv) / sizeof(*argv);
+  // Later arguments override the file, which overrides earlier ones; a
+  // duplicate user line is ignored, and k1 must not match k10.
+  ok = ok && check("k1", argc, argv,
+                   "questions=1 attempts=5 questions=3 ops=+- batch=1");
+  ok = ok && check("k2", argc, argv,
+                   "questions=1 questions=0 questions=2 batch=1");
+  ok = ok && check("k10", argc, argv, "questions=1 attempts=1 batch=1");
+  ok = ok && check("k3", argc, argv, "questions=1 batch=1");
+
+  // Editing the file in place is noticed, and changes the version.
+  unsigned long version = options_version(argc, argv);
+  ok = ok && write_file(db, "k3 ops=*\n");
+  ok = ok && check("k3", argc, argv, "questions=1 ops=* batch=1");
+  ok = ok && check("k1", argc, argv, "questions=1 attempts=5 batch=1");
+  if (ok && options_version(argc, argv) == version) {
+    printf("FAIL: version unchanged after editing the file\n");
+    ok = 0;
+  }
+
+  // A missing file applies no fields.
+  unlink(db);
+  ok = ok && check("k3", argc, argv, "questions=1 batch=1");
+  rmdir(dir);
+
+  printf(ok ? "PASS\n" : "FAIL\n");
+  return !ok;
+}
@@ -0,0 +1,105 @@
+#define _POSIX_C_SOURCE 200809L
+
+// Checks that make_question_records gives the same answers as the oracle of
+// the benchmarks, i.e. the ones make_question would accept, and that it
+// stops cleanly when the buffer is full.
+//
+// Usage: test_records_math | test_records_questions_file [config args...]
+
+#include <stdio.h>  // for printf, NULL, size_t
+#include <string.h> // for strcmp, strlen
+
+#include "fake_pam.h"  // for oracle_t
+#include "helpers.h"   // for random_init, random_lanes_fork, random_t, ...
+#include "questions.h" // for build_config, free_config, make_question_...
+
+#define RECORDS 1000
+#define ANSWER_MAX 1024
+
+// Only the oracle of the module linked in is defined.
+extern const oracle_t math_oracle __attribute__((weak));
+extern const oracle_t questions_file_oracle __attribute__((weak));
+
+static char buf[RECORDS * 256];
+static question_record_t records[RECORDS];
+
+// Returns the number of wrong answers.
+static int test_config(const oracle_t *oracle, int argc, const char **argv) {
+  config_t *config = build_config("user", argc, argv);
+  void *state = oracle->init("user", argc, argv);
+  if (config == NULL || state == NULL) {
+    printf("FAIL: could not build config\n");
+    return 1;
+  }
+  random_t rng;
+  random_init(&rng);
+  random_lanes_t lanes;
+  random_lanes_fork(&rng, &lanes);
+  int made = make_question_records(config, &rng, &lanes, RECORDS, records,
+                                   buf, sizeof(buf));
+  int failures = 0;
+  if (made != RECORDS) {
+    printf("FAIL: made %d of %d records\n", made, RECORDS);
+    ++failures;
+  }
+  for (int i = 0; i < made; ++i) {
+    char expected[ANSWER_MAX];
+    if (!oracle->answer(state, records[i].question, expected,
+                        sizeof(expected)) ||
+        strcmp(records[i].answer, expected)) {
+      printf("FAIL: %s: got %s\n", records[i].question, records[i].answer);
+      ++failures;
+    }
+  }
+
+  // A buffer too small for all of them only gets whole records.
+  int partial =
+      make_question_records(config, &rng, &lanes, RECORDS, records, buf, 100);
+  if (partial <= 0 || partial >= RECORDS) {
+    printf("FAIL: made %d records into 100 bytes\n", partial);
+    ++failures;
+  }
+  for (int i = 0; i < partial; ++i) {
+    if (records[i].answer + strlen(records[i].answer) >= buf + 100) {
+      printf("FAIL: record %d overflows the buffer\n", i);
+      ++failures;
+    }
+  }
+
+  oracle->free(state);
+  free_config(config);
+  printf("%s: %d records, %d wrong\n", argv[0], made, failures);
+  return failures;
+}
+
+int main(int argc, char **argv) {
+  const oracle_t *oracle = &math_oracle;
+  if (oracle == NULL) {
+    oracle = &questions_file_oracle;
+  }
+  int failures = 0;
+  if (argc > 1) {
+    failures += test_config(oracle, argc - 1, (const char **)argv + 1);
+  } else if (oracle == &math_oracle) {
+    static const char *const configs[][6] = {
+        {".ops=+-*/mrdqc", ".use_utf8=no"},
+        {".ops=+-*/mrdqc", ".use_utf8=yes"},
+        {".ops=+-*/mrdqc", ".use_utf8=no", ".amin=-100", ".amax=100",
+         ".mmin=-12", ".mmax=12"},
+        {".ops=+-*", ".use_utf8=no", ".amin=-1000000", ".amax=0",
+         ".mmin=1000", ".mmax=30000"},
+    };
+    for (size_t i = 0; i < sizeof(configs) / sizeof(*configs); ++i) {
+      int n = 0;
+      while (n < 6 && configs[i][n] != NULL) {
+        ++n;
+      }
+      failures += test_config(oracle, n, (const char **)configs[i]);
+    }
+  } else {
+    const char *config[] = {".file=examples/questions.csv"};
+    failures += test_config(oracle, 1, config);
+  }
+  printf(failures == 0 ? "PASS\n" : "FAIL\n");
+  return failures != 0;
+}